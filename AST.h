@@ -12,58 +12,195 @@ Description:
     comparison operators (>, <, >=, <=), and basic control flow statements (if-then, if-then-else,
     and while-do) common to the Pascal programming language.
 
-    Compilation occurs in a single pass, with backpatching for jump targets inserted after compilation
-    of the appropriate control flow structures. This compilation currently supports optional blocks
-    of statements as well as nested blocks but has not been tested thoroughly for various nesting of
-    statements that feature jump statements. Most register lifetimes are handled automatically with
-    constants and expressions freeing their registers back to the register pool after their respective
-    code segments have been recursively passed on to higher members of the tree. There is a limit of
-    14 total registers that can be allocated to nodes in the tree at any given time, after which 
-    undefined behavior may occur as there is currently no implementation for spilling registers
-    into memory. Additionally, values cannot be stored to memory under the current implementation,
-    leaving the compiler limited in the complexity it can handle in a program.
-
-    Evaluation uses an externally defined symbol map linking symbol identifiers to their respective
-    nodes, which store, update and output their values as necessary.
+    Compilation occurs in a single pass, appending typed instructions (see IR.h) to one buffer owned
+    by the program. Control flow jumps to symbolic labels, which are resolved to instruction indices
+    by one fix-up pass once the whole program has been compiled. This compilation currently supports
+    optional blocks of statements as well as nested blocks but has not been tested thoroughly for
+    various nesting of statements that feature jump statements. Constants, expressions and variables
+    are compiled into virtual registers, which a linear-scan register allocator (see regalloc.h) maps
+    onto the 14 general purpose registers after compilation, spilling values to data memory with
+    MEM LOAD/STOR when there are not enough registers for everything live at once.
+
+    Before any code is generated the expression trees are folded: constant subtrees are replaced with
+    their values (wrapping at 32 bits like the VM), constants are gathered on the right of + and *
+    so chains such as (x + 1) + 2 combine, and identities such as x + 0, x * 1 and x * 0 drop out,
+    except that x * 0 keeps x when x divides by something not known to be non-zero, so the division
+    still faults.
+    Innermost WHILE loops stepping a variable by one towards a constant bound are counted down in
+    R_CNT with CNT/LOOP, leaving one control instruction per iteration instead of COMP, JMPC and JMP.
+
+    Evaluation uses the variable nodes handed out by the symbol table (see symbols.h), which store,
+    update and output their values as necessary.
+
+    All nodes are placed in the arena of the compilation they belong to (see arena.h and context.h)
+    with "new (pool)" and are released together with it, so nodes never own heap memory. Nothing in
+    this file is global, so separate compilations can build and compile trees concurrently.
 */
 
+#ifndef AST_H
+#define AST_H
 
+#include <algorithm>
 #include <iostream>
 #include <stdio.h>
 #include <memory>
 #include <vector>
 #include <list>
 #include <map>
+#include "IR.h"
+#include "regalloc.h"
+#include "liveness.h"
+#include "redundancy.h"
+#include "peephole.h"
+#include "arena.h"
+#include "output.h"
+#include "evaluator.h"
+#include "instrument.h"
 
-extern std::list<std::string> regs; // list of string representation of register numbers for SAD VM
-extern int line_num; // line number counter
+class statement;
+// statement lists are allocated in and grow inside the AST arena
+typedef std::vector<statement*, arena_allocator<statement*> > statement_vector;
+
+// raised when evaluating the tree hits something the VM would fault on
+struct evaluation_error {
+    const char* message;
+    evaluation_error(const char* message_) : message(message_) { }
+};
 
 // General base class for all expressions
-// Temporary registers for storing evaluated values of expressions occurs by popping them
-// off the register list and later pushing them back on when no longer needed.
+// Every expression result is placed in a fresh virtual register, mapped onto the physical
+// SAD VM registers by the register allocator after the whole program has been compiled.
 // Each node can store two children, the left and right operands for a general expression.
 // Each inherited node type implements its own print, evaluate and compile functions according
 // to their needs.
 //
-// Each node also has storage for its respective SAD VM instruction code, which is generated
-// through recursive traversal of the abstract syntax tree constructed during parsing.
+// SAD VM instruction code is generated through recursive traversal of the abstract syntax tree
+// constructed during parsing, with every node appending its instructions to the program's code.
 class expression_node {
     protected: 
-        std::string get_reg() {
-            std::string reg = regs.front();
-            regs.pop_front();
-            return reg;
+        // shared code generation for binary arithmetic and comparison nodes
+        void compile_math(code_buffer& code, int mode) {
+            expression_node* base;
+            int value;
+            if (split_immediate(mode, &base, &mode, &value)) {
+                // constant operands are applied in place with MATHI/INC/DEC, temporaries are
+                // updated directly while variables are copied first so they keep their value
+                base->compile(code);
+                if (base->variable()) {
+                    addr = code.new_vreg();
+                    code.emit(ir_mov(addr, base->addr));
+                }
+                else {
+                    addr = base->addr;
+                }
+                code.emit(ir_immediate(addr, mode, value));
+                return;
+            }
+            // getting temporary address to store result in
+            addr = code.new_vreg();
+            left->compile(code);
+            right->compile(code);
+            code.emit(ir_math(addr, left->addr, right->addr, mode));
         }
+        // comparisons used as values produce 1 when true and 0 when false
+        void compile_comp(code_buffer& code) {
+            addr = code.new_vreg();
+            int done_label = code.new_label();
+            code.emit(ir_limm(addr, 0));
+            compile_branch(code, done_label, false);
+            code.emit(ir_limm(addr, 1));
+            code.bind(done_label);
+        }
+        // shared lowering for arithmetic nodes, constant operands are applied to the top of the stack
+        void lower_math(eval_code& code, int op) {
+            int value;
+            if (right->constant(&value) && op != EVAL_DIV) {
+                left->lower(code);
+                if (op == EVAL_SUB) code.emit(EVAL_ADDK, 0u - (uint32_t)value);
+                else code.emit(op == EVAL_ADD ? EVAL_ADDK : EVAL_MULTK, value);
+                return;
+            }
+            if (right->constant(&value)) {
+                left->lower(code);
+                code.emit(EVAL_DIVK, value);
+                return;
+            }
+            left->lower(code);
+            right->lower(code);
+            code.emit(op);
+        }
+        // shared test for immediate() in arithmetic nodes, true when the right operand is a constant
+        // small enough for a MATHI immediate
+        bool split_immediate(int op, expression_node** base, int* mode, int* value) {
+            if (!right->constant(value) || *value < SAD_MATHI_MIN || *value > SAD_MATHI_MAX) return false;
+            *base = left;
+            *mode = op;
+            return true;
+        }
+        // shared folding for comparison nodes, comparisons of constants or of a variable with
+        // itself are known at compile time
+        expression_node* fold_comp(arena& pool, int mode);
     public:
-        std::list<std::string> code; // storage for generated code
-        std::string addr; // register location for each node
+        int addr; // register location for each node
         expression_node* left;
         expression_node* right;
+        expression_node() : addr(-1), left(NULL), right(NULL) { }
         virtual void print() = 0;
         virtual int evaluate() = 0;
-        virtual std::list<std::string>* compile() = 0;
-        virtual void free_reg()  { regs.push_front(addr); addr = ""; }
-        
+        virtual void compile(code_buffer& code) = 0;
+        // compiles the expression as a condition jumping to target when its truth equals jump_if,
+        // comparisons become a single COMP (inverted to jump when true) and JMPC with no result
+        // register, any other value is tested against zero
+        void compile_branch(code_buffer& code, int target, bool jump_if) {
+            int mode = comparison();
+            if (mode >= 0) {
+                left->compile(code);
+                right->compile(code);
+                code.emit(ir_comp(left->addr, right->addr, jump_if ? ir_invert_comp(mode) : mode));
+            }
+            else {
+                compile(code);
+                int zero = code.new_vreg();
+                code.emit(ir_limm(zero, 0));
+                code.emit(ir_comp(addr, zero, jump_if ? COMP_EQ : COMP_NEQ));
+            }
+            code.emit(ir_jump(OP_JMPC, target));
+        }
+
+        // lowers the expression into bytecode for the in-process evaluator (see evaluator.h),
+        // leaving its value on top of the stack
+        virtual void lower(eval_code& code) = 0;
+        // lowers the expression as a condition, returning the index of a jump taken when its truth
+        // equals jump_if for the caller to patch
+        int lower_branch(eval_code& code, bool jump_if) {
+            int mode = comparison();
+            if (mode >= 0) {
+                left->lower(code);
+                right->lower(code);
+                return code.emit(eval_branch_op(jump_if ? mode : ir_invert_comp(mode)));
+            }
+            lower(code);
+            return code.emit(jump_if ? EVAL_JT : EVAL_JF);
+        }
+
+        // constant folding and algebraic simplification run before compilation, returning the
+        // node to use in place of this one (new nodes are placed in the AST arena)
+        virtual expression_node* fold(arena& pool) { return this; }
+        // true for constant nodes, storing their value
+        virtual bool constant(int* value) { return false; }
+        // true for variable nodes
+        virtual bool variable() { return false; }
+        // true for nodes of the form x + c, storing x and c
+        virtual bool offset(expression_node** base, int* amount) { return false; }
+        // true for nodes of the form x * c, storing x and c
+        virtual bool scale(expression_node** base, int* factor) { return false; }
+        // true for arithmetic nodes compiled as x op c with c fitting a MATHI immediate, storing x,
+        // the math mode and c
+        virtual bool immediate(expression_node** base, int* mode, int* value) { return false; }
+        // comparison mode for comparison nodes, -1 for everything else
+        virtual int comparison() { return -1; }
+        // true when evaluating the subtree may fault, so folding must not drop it
+        virtual bool may_fault() { return (left && left->may_fault()) || (right && right->may_fault()); }
 };
 
 // leaf node for storing constant integer numbers
@@ -74,31 +211,39 @@ class num_node : public expression_node {
         num_node(int val_) : val(val_) { }
         void print() { std::cout << val; }
         int evaluate() { return val; }
-        std::list<std::string>* compile() {
-            addr = get_reg();
-            // build the load immediate instruction to load the value
-            std::string num_code = "(LIMM, " + addr + ", " + std::to_string(val) + ")";
-            code.push_front(num_code);
-            line_num++;
-
-            return &code;
+        bool constant(int* value) { *value = val; return true; }
+        void lower(eval_code& code) { code.emit(EVAL_CONST, val); }
+        void compile(code_buffer& code) {
+            addr = code.new_vreg();
+            // build the load immediate instruction to load the value, values wider than the
+            // LIMM immediate are built from their upper bits and the low 12 bits
+            if (val >= SAD_LIMM_MIN && val <= SAD_LIMM_MAX) {
+                code.emit(ir_limm(addr, val));
+            }
+            else {
+                code.emit(ir_limm(addr, val >> 12));
+                code.emit(ir_mathi(addr, MATH_MULT, 4096));
+                code.emit(ir_mathi(addr, MATH_ADD, val & 0xfff));
+            }
         }
 };
 
 // leaf node for storing variables of integer type
-// stores both the string identifier as well as the value of the node
+// stores both the string identifier (owned by the AST arena) as well as the value of the node
+// variables are created by the symbol table (see symbols.h), which numbers them densely by slot
 class var_node : public expression_node {
     protected:
-        std::string id;
+        const char* id;
     public:
         int val;
-        var_node(std::string id_) : id(std::string(id_)) { addr = get_reg(); }
+        int slot;
+        var_node(const char* id_, int slot_) : id(id_), val(0), slot(slot_) { }
         void print() { std::cout << id; }
         int evaluate() { return val; }
-        std::list<std::string>* compile() {
-            return new std::list<std::string>();
-        }
-        void free_reg() { return; } 
+        bool variable() { return true; }
+        void lower(eval_code& code) { code.emit(EVAL_LOAD, slot); }
+        // a variable keeps one virtual register for the whole program, the one reserved for its slot
+        void compile(code_buffer& code) { addr = IR_VREG_BASE + slot; }
 };
 
 // node for addition expressions
@@ -113,31 +258,42 @@ class add_node : public expression_node {
             std::cout << ")";
         }
         int evaluate() {
-            return left->evaluate() + right->evaluate();
+            return (uint32_t)left->evaluate() + (uint32_t)right->evaluate();
         }
-        std::list<std::string>* compile() {
-            // getting temporary address to store result in
-            addr = get_reg();
-            // assembling code for ADD
-            std::list<std::string> *left_code = left->compile();
-            std::list<std::string>::iterator i;
-            for (i = left_code->begin(); i != left_code->end(); i++) {
-                code.push_back(*i);
+        expression_node* fold(arena& pool) {
+            left = left->fold(pool);
+            right = right->fold(pool);
+            return simplify(pool);
+        }
+        // simplification once both operands have been folded
+        expression_node* simplify(arena& pool) {
+            int l, r;
+            // constants are kept on the right unless both sides fold away
+            if (left->constant(&l)) {
+                if (right->constant(&r)) return new (pool) num_node((uint32_t)l + (uint32_t)r);
+                std::swap(left, right);
             }
-            std::list<std::string> *right_code = right->compile();
-            for (i = right_code->begin(); i != right_code->end(); i++) {
-                code.push_back(*i);
+            if (!right->constant(&r)) return this;
+            if (r == 0) return left;
+            // (x + a) + b becomes x + (a + b)
+            expression_node* base;
+            int a;
+            if (left->offset(&base, &a)) {
+                int sum = (uint32_t)a + (uint32_t)r;
+                if (sum == 0) return base;
+                left = base;
+                right = new (pool) num_node(sum);
             }
-            std::string add_code = "(MATH, " + addr + ", " + left->addr + ", " + right->addr + ", ADD)";
-            code.push_back(add_code);
-            line_num++;
-
-            // cleaning up registers to be reused
-            right->free_reg();
-            left->free_reg();
-
-            return &code;
+            return this;
+        }
+        bool offset(expression_node** base, int* amount) {
+            if (!right->constant(amount)) return false;
+            *base = left;
+            return true;
         }
+        bool immediate(expression_node** base, int* mode, int* value) { return split_immediate(MATH_ADD, base, mode, value); }
+        void compile(code_buffer& code) { compile_math(code, MATH_ADD); }
+        void lower(eval_code& code) { lower_math(code, EVAL_ADD); }
 };
 
 // node for subtraction expressions
@@ -152,31 +308,24 @@ class sub_node : public expression_node {
             std::cout << ")";
         }
         int evaluate() {
-            return left->evaluate() - right->evaluate();
+            return (uint32_t)left->evaluate() - (uint32_t)right->evaluate();
         }
-        std::list<std::string>* compile() {
-            // getting temporary address to store result in
-            addr = get_reg();
-            // assembling code for SUB
-            std::list<std::string> *left_code = left->compile();
-            std::list<std::string>::iterator i;
-            for (i = left_code->begin(); i != left_code->end(); i++) {
-                code.push_back(*i);
-            }
-            std::list<std::string> *right_code = right->compile();
-            for (i = right_code->begin(); i != right_code->end(); i++) {
-                code.push_back(*i);
+        expression_node* fold(arena& pool) {
+            left = left->fold(pool);
+            right = right->fold(pool);
+            int l, r;
+            if (right->constant(&r)) {
+                if (left->constant(&l)) return new (pool) num_node((uint32_t)l - (uint32_t)r);
+                // x - c is handled as x + (-c) so offsets combine
+                add_node* sum = new (pool) add_node(left, new (pool) num_node(0u - (uint32_t)r));
+                return sum->simplify(pool);
             }
-            std::string sub_code = "(MATH, " + addr + ", " + left->addr + ", " + right->addr + ", SUB)";
-            code.push_back(sub_code);
-            line_num++;
-
-            // cleaning up registers to be reused
-            right->free_reg();
-            left->free_reg();
-
-            return &code;
+            if (left == right && left->variable()) return new (pool) num_node(0);
+            return this;
         }
+        bool immediate(expression_node** base, int* mode, int* value) { return split_immediate(MATH_SUB, base, mode, value); }
+        void compile(code_buffer& code) { compile_math(code, MATH_SUB); }
+        void lower(eval_code& code) { lower_math(code, EVAL_SUB); }
 };
 
 // node for multiplication expressions
@@ -191,31 +340,40 @@ class mult_node : public expression_node {
             std::cout << ")";
         }
         int evaluate() {
-            return left->evaluate() * right->evaluate();
+            return (uint32_t)left->evaluate() * (uint32_t)right->evaluate();
         }
-        std::list<std::string>* compile() {
-            // getting temporary address to store result in
-            addr = get_reg();
-            // assembling code for MULT
-            std::list<std::string> *left_code = left->compile();
-            std::list<std::string>::iterator i;
-            for (i = left_code->begin(); i != left_code->end(); i++) {
-                code.push_back(*i);
+        expression_node* fold(arena& pool) {
+            left = left->fold(pool);
+            right = right->fold(pool);
+            int l, r;
+            if (left->constant(&l)) {
+                if (right->constant(&r)) return new (pool) num_node((uint32_t)l * (uint32_t)r);
+                std::swap(left, right);
             }
-            std::list<std::string> *right_code = right->compile();
-            for (i = right_code->begin(); i != right_code->end(); i++) {
-                code.push_back(*i);
+            if (!right->constant(&r)) return this;
+            // x * 0 keeps x when x may divide by zero, for the VM to report
+            if (r == 0) return left->may_fault() ? this : right;
+            if (r == 1) return left;
+            // (x * a) * b becomes x * (a * b)
+            expression_node* base;
+            int a;
+            if (left->scale(&base, &a)) {
+                left = base;
+                right = new (pool) num_node((uint32_t)a * (uint32_t)r);
+                return this;
             }
-            std::string mult_code = "(MATH, " + addr + ", " + left->addr + ", " + right->addr + ", MULT)";
-            code.push_back(mult_code);
-            line_num++;
-
-            // cleaning up registers to be reused
-            right->free_reg();
-            left->free_reg();
-
-            return &code;
+            // SAD VM has no shifts, but doubling a variable needs no constant load as x + x
+            if (r == 2 && left->variable()) return new (pool) add_node(left, left);
+            return this;
+        }
+        bool scale(expression_node** base, int* factor) {
+            if (!right->constant(factor)) return false;
+            *base = left;
+            return true;
         }
+        bool immediate(expression_node** base, int* mode, int* value) { return split_immediate(MATH_MULT, base, mode, value); }
+        void compile(code_buffer& code) { compile_math(code, MATH_MULT); }
+        void lower(eval_code& code) { lower_math(code, EVAL_MULT); }
 };
 
 // node for division expressions - does not handle divide by 0
@@ -230,31 +388,29 @@ class div_node : public expression_node {
             std::cout << ")";
         }
         int evaluate() {
-            return left->evaluate() / right->evaluate();
+            int divisor = right->evaluate();
+            int dividend = left->evaluate();
+            if (divisor == 0) throw evaluation_error("division by zero");
+            return sad_div(dividend, divisor);
         }
-        std::list<std::string>* compile() {
-            // getting temporary address to store result in
-            addr = get_reg();
-            // assembling code for DIV
-            std::list<std::string> *left_code = left->compile();
-            std::list<std::string>::iterator i;
-            for (i = left_code->begin(); i != left_code->end(); i++) {
-                code.push_back(*i);
-            }
-            std::list<std::string> *right_code = right->compile();
-            for (i = right_code->begin(); i != right_code->end(); i++) {
-                code.push_back(*i);
-            }
-            std::string div_code = "(MATH, " + addr + ", " + left->addr + ", " + right->addr + ", DIV)";
-            code.push_back(div_code);
-            line_num++;
-
-            // cleaning up registers to be reused
-            left->free_reg();
-            right->free_reg();
-
-            return &code;
+        // folding follows the SAD VM's rounding towards negative infinity, division by a constant
+        // zero is left for the VM to report
+        expression_node* fold(arena& pool) {
+            left = left->fold(pool);
+            right = right->fold(pool);
+            int l, r;
+            if (!right->constant(&r)) return this;
+            if (left->constant(&l) && r != 0) return new (pool) num_node(sad_div(l, r));
+            if (r == 1) return left;
+            return this;
+        }
+        bool may_fault() {
+            int r;
+            return !right->constant(&r) || r == 0 || left->may_fault();
         }
+        bool immediate(expression_node** base, int* mode, int* value) { return split_immediate(MATH_DIV, base, mode, value); }
+        void compile(code_buffer& code) { compile_math(code, MATH_DIV); }
+        void lower(eval_code& code) { lower_math(code, EVAL_DIV); }
         
 };
 
@@ -272,24 +428,14 @@ class gt_node : public expression_node {
         int evaluate() {
             return left->evaluate() > right->evaluate();
         }
-        std::list<std::string>* compile() {
-            addr = get_reg();
-            // assembling code for GT comparison
-            std::list<std::string> *left_code = left->compile();
-            std::list<std::string>::iterator i;
-            for (i = left_code->begin(); i != left_code->end(); i++) {
-                code.push_back(*i);
-            }
-            std::list<std::string> *right_code = right->compile();
-            for (i = right_code->begin(); i != right_code->end(); i++) {
-                code.push_back(*i);
-            }
-            std::string gt_code = "(COMP, " + left->addr + ", " + right->addr + ", GT)";
-            code.push_back(gt_code);
-            line_num++;
-
-            return &code;
+        expression_node* fold(arena& pool) { return fold_comp(pool, COMP_GT); }
+        int comparison() { return COMP_GT; }
+        void lower(eval_code& code) {
+            left->lower(code);
+            right->lower(code);
+            code.emit(EVAL_GT);
         }
+        void compile(code_buffer& code) { compile_comp(code); }
 };
 
 // node for less-than comparison expressions
@@ -306,24 +452,14 @@ class lt_node : public expression_node {
         int evaluate() {
             return left->evaluate() < right->evaluate();
         }
-        std::list<std::string>* compile() {
-            addr = get_reg();
-            // assembling code for LT comparison
-            std::list<std::string> *left_code = left->compile();
-            std::list<std::string>::iterator i;
-            for (i = left_code->begin(); i != left_code->end(); i++) {
-                code.push_back(*i);
-            }
-            std::list<std::string> *right_code = right->compile();
-            for (i = right_code->begin(); i != right_code->end(); i++) {
-                code.push_back(*i);
-            }
-            std::string gt_code = "(COMP, " + left->addr + ", " + right->addr + ", LT)";
-            code.push_back(gt_code);
-            line_num++;
-
-            return &code;
+        expression_node* fold(arena& pool) { return fold_comp(pool, COMP_LT); }
+        int comparison() { return COMP_LT; }
+        void lower(eval_code& code) {
+            left->lower(code);
+            right->lower(code);
+            code.emit(EVAL_LT);
         }
+        void compile(code_buffer& code) { compile_comp(code); }
 };
 
 // node for greather than or equal comparison expressions
@@ -340,24 +476,14 @@ class gte_node : public expression_node {
         int evaluate() {
             return left->evaluate() >= right->evaluate();
         }
-        std::list<std::string>* compile() {
-            addr = get_reg();
-            // assembling code for GTE comparison
-            std::list<std::string> *left_code = left->compile();
-            std::list<std::string>::iterator i;
-            for (i = left_code->begin(); i != left_code->end(); i++) {
-                code.push_back(*i);
-            }
-            std::list<std::string> *right_code = right->compile();
-            for (i = right_code->begin(); i != right_code->end(); i++) {
-                code.push_back(*i);
-            }
-            std::string gt_code = "(COMP, " + left->addr + ", " + right->addr + ", GTE)";
-            code.push_back(gt_code);
-            line_num++;
-
-            return &code;
+        expression_node* fold(arena& pool) { return fold_comp(pool, COMP_GTE); }
+        int comparison() { return COMP_GTE; }
+        void lower(eval_code& code) {
+            left->lower(code);
+            right->lower(code);
+            code.emit(EVAL_GTE);
         }
+        void compile(code_buffer& code) { compile_comp(code); }
 };
 
 // node for less than or equal comparison expressions
@@ -374,37 +500,109 @@ class lte_node : public expression_node {
         int evaluate() {
             return left->evaluate() <= right->evaluate();
         }
-        std::list<std::string>* compile() {
-            addr = get_reg();
-            // assembling code for LTE comparison
-            std::list<std::string> *left_code = left->compile();
-            std::list<std::string>::iterator i;
-            for (i = left_code->begin(); i != left_code->end(); i++) {
-                code.push_back(*i);
-            }
-            std::list<std::string> *right_code = right->compile();
-            for (i = right_code->begin(); i != right_code->end(); i++) {
-                code.push_back(*i);
-            }
-            std::string gt_code = "(COMP, " + left->addr + ", " + right->addr + ", LTE)";
-            code.push_back(gt_code);
-            line_num++;
-
-            return &code;
+        expression_node* fold(arena& pool) { return fold_comp(pool, COMP_LTE); }
+        int comparison() { return COMP_LTE; }
+        void lower(eval_code& code) {
+            left->lower(code);
+            right->lower(code);
+            code.emit(EVAL_LTE);
         }
+        void compile(code_buffer& code) { compile_comp(code); }
 };
 
-// general class for statements with storage for an expression node and compiled SAD VM code
+inline expression_node* expression_node::fold_comp(arena& pool, int mode) {
+    left = left->fold(pool);
+    right = right->fold(pool);
+    int l, r;
+    bool known = false;
+    if (left->constant(&l) && right->constant(&r)) {
+        known = true;
+    }
+    else if (left == right && left->variable()) {
+        l = r = 0;
+        known = true;
+    }
+    if (!known) return this;
+    bool result = mode == COMP_GT ? l > r : mode == COMP_LT ? l < r : mode == COMP_GTE ? l >= r : l <= r;
+    return new (pool) num_node(result);
+}
+
+// general class for statements with storage for an expression node, compiling SAD VM code
+// into the program's instruction vector
 class statement {
     protected:
-        std::list<std::string> code; // storage for concatenated code strings
         expression_node* expression; // expression for each statement
+        int line; // source line the statement starts on, 0 if unknown
     public:
+        statement() : line(0) { }
+        void set_line(int line_) { line = line_; }
+        int source_line() const { return line; }
         virtual void print() = 0;
         virtual void evaluate() = 0;
-        virtual std::list<std::string>* compile() = 0;
+        // runs the statement without any tracing, writing program output to out
+        virtual void execute(output_buffer& out) = 0;
+        // appends the statement's bytecode for the in-process evaluator
+        virtual void lower(eval_code& code) = 0;
+        virtual void compile(code_buffer& code) = 0;
+        // folds the statement's expressions and those of any nested statements
+        virtual void fold(arena& pool) { expression = expression->fold(pool); }
+
+        // loop analysis, whether this statement or any nested in it assigns var or contains a loop
+        virtual bool assigns(expression_node* var) { return false; }
+        virtual bool loops() { return false; }
+        // true for the assignment var := var + step
+        virtual bool steps(expression_node* var, int step) { return false; }
 };
 
+inline void fold_statements(statement_vector* statements, arena& pool) {
+    statement_vector::iterator stmt;
+    for (stmt = statements->begin(); stmt != statements->end(); stmt++) {
+        (*stmt)->fold(pool);
+    }
+}
+
+inline void execute_statements(statement_vector* statements, output_buffer& out) {
+    statement_vector::iterator stmt;
+    for (stmt = statements->begin(); stmt != statements->end(); stmt++) {
+        (*stmt)->execute(out);
+    }
+}
+
+inline void lower_statements(statement_vector* statements, eval_code& code) {
+    statement_vector::iterator stmt;
+    for (stmt = statements->begin(); stmt != statements->end(); stmt++) {
+        (*stmt)->lower(code);
+    }
+}
+
+// compiles each statement with its source line recorded on its instructions (see code_buffer::line),
+// code the enclosing statement emits afterwards is its own again
+inline void compile_statements(statement_vector* statements, code_buffer& code) {
+    int outer = code.line;
+    statement_vector::iterator stmt;
+    for (stmt = statements->begin(); stmt != statements->end(); stmt++) {
+        code.line = (*stmt)->source_line();
+        (*stmt)->compile(code);
+    }
+    code.line = outer;
+}
+
+inline bool statements_assign(statement_vector* statements, expression_node* var) {
+    statement_vector::iterator stmt;
+    for (stmt = statements->begin(); stmt != statements->end(); stmt++) {
+        if ((*stmt)->assigns(var)) return true;
+    }
+    return false;
+}
+
+inline bool statements_loop(statement_vector* statements) {
+    statement_vector::iterator stmt;
+    for (stmt = statements->begin(); stmt != statements->end(); stmt++) {
+        if ((*stmt)->loops()) return true;
+    }
+    return false;
+}
+
 // class for handling assignment statements, this node will update variables
 // appropriately after assignment during evaluation
 class assign_statement : public statement {
@@ -421,40 +619,58 @@ class assign_statement : public statement {
             int result = expression->evaluate();
             id->val = result;
         }
-        std::list<std::string>* compile() {
-            // getting code from members and generating assign code
-            std::list<std::string>* expr_code = expression->compile();
-            std::string assign_code = "(MOV, " + id->addr + ", " + expression->addr + ")";
-
-            // concatenating code
-            std::list<std::string>::iterator i;
-            for (i = expr_code->begin(); i != expr_code->end(); i++) {
-                code.push_back(*i);
+        void execute(output_buffer& out) { id->val = expression->evaluate(); }
+        void lower(eval_code& code) {
+            // x := x + c and x := x - c update the slot in place
+            expression_node* base;
+            int mode, value;
+            if (expression->immediate(&base, &mode, &value) && base == id && (mode == MATH_ADD || mode == MATH_SUB)) {
+                code.emit(EVAL_STEP, id->slot, mode == MATH_ADD ? value : (int32_t)(0u - (uint32_t)value));
+                return;
             }
-            code.push_back(assign_code);
-            line_num++;
-
-            // cleaning up expression register for reuse
-            expression->free_reg();
-
-            return &code;
+            expression->lower(code);
+            code.emit(EVAL_STORE, id->slot);
+        }
+        bool assigns(expression_node* var) { return id == var; }
+        bool steps(expression_node* var, int step) {
+            expression_node* base;
+            int mode, value;
+            if (id != var || !expression->immediate(&base, &mode, &value) || base != var) return false;
+            return (mode == MATH_ADD && value == step) || (mode == MATH_SUB && value == -step);
+        }
+        void compile(code_buffer& code) {
+            // updating a variable by a constant, such as i := i + 1, is done in place and copying
+            // another variable first avoids going through a temporary
+            expression_node* base;
+            int mode, value;
+            if (expression->immediate(&base, &mode, &value) && base->variable()) {
+                base->compile(code);
+                id->compile(code);
+                if (base != id) code.emit(ir_mov(id->addr, base->addr));
+                code.emit(ir_immediate(id->addr, mode, value));
+                return;
+            }
+            // getting code from members and generating assign code
+            expression->compile(code);
+            id->compile(code);
+            code.emit(ir_mov(id->addr, expression->addr));
         }
 };
 
 // class for handling IF-THEN statements, supporting optional blocks of statements in the THEN section
 // during evaluation, the condition expression is evaluated and the appropriate code is executed
-// during compilation, the condition expression is compiled first followed by the THEN statements
-// after statements have been compiled, the appropriate jump target is backpatched in
+// during compilation, the condition expression is compiled first followed by a jump to a label
+// placed after the THEN statements
 class if_statement : public statement {
     protected:
-        std::vector<statement*>* statement_list;
+        statement_vector* statement_list;
     public:
-        if_statement(expression_node* exp, std::vector<statement*> *then_statement) : statement_list(then_statement) { expression = exp; }
+        if_statement(expression_node* exp, statement_vector *then_statement) : statement_list(then_statement) { expression = exp; }
         void print() {
             std::cout << "IF ";
             expression->print();
             std::cout << " THEN: ";
-            std::vector<statement*>::iterator stmt;
+            statement_vector::iterator stmt;
             std::cout << "{" << std::endl;
             for (stmt = statement_list->begin(); stmt != statement_list->end(); stmt++) {
                 std::cout << "\t";
@@ -466,64 +682,59 @@ class if_statement : public statement {
             std::cout << "Evaluating IF cond: " << bool(expression->evaluate()) << std::endl;
             if (expression->evaluate()) {
                 std::cout << "Evaluating statements: ";
-                std::vector<statement*>::iterator stmt;
+                statement_vector::iterator stmt;
                 for (stmt = statement_list->begin(); stmt != statement_list->end(); stmt++) {
                     (*stmt)->print();
                     (*stmt)->evaluate();
                 }
             }
         }
-        std::list<std::string>* compile() {
-            std::list<std::string>* expr_code = expression->compile();
-            std::list<std::string>::iterator i;
-            for (i = expr_code->begin(); i != expr_code->end(); i++) {
-                code.push_back(*i);
-            }
-
-            // flags for looking for first code of THEN statement for JUMP
-            std::list<std::string>::iterator first_code;
-            bool is_first = true;
-
-            // looping through statement_list code
-            std::vector<statement*>::iterator stmt;
-            for (stmt = statement_list->begin(); stmt != statement_list->end(); stmt++) {
-                std::list<std::string>* stmt_code = (*stmt)->compile();
-                for (i = stmt_code->begin(); i != stmt_code->end(); i++) {
-                    if (is_first) {
-                        is_first = false;
-                        code.push_back(*i);
-                        first_code = --code.end();
-                    }
-                    else {
-                        code.push_back(*i);
-                    }
-                }
+        void execute(output_buffer& out) {
+            if (expression->evaluate()) execute_statements(statement_list, out);
+        }
+        void lower(eval_code& code) {
+            int skip = expression->lower_branch(code, false);
+            lower_statements(statement_list, code);
+            code.patch(skip, code.here());
+        }
+        void fold(arena& pool) {
+            expression = expression->fold(pool);
+            fold_statements(statement_list, pool);
+        }
+        bool assigns(expression_node* var) { return statements_assign(statement_list, var); }
+        bool loops() { return statements_loop(statement_list); }
+        void compile(code_buffer& code) {
+            int known;
+            if (expression->constant(&known)) {
+                // a condition folded to a constant leaves only the THEN block, or nothing at all
+                if (!known) return;
+                compile_statements(statement_list, code);
+                return;
             }
+            // jump out of THEN block when the condition is false
+            int end_label = code.new_label();
+            expression->compile_branch(code, end_label, false);
 
-            // backpatching the jump out of THEN block
-            std::string jump_code = "(JMPC, " + std::to_string(++line_num) + ")";
-            code.insert(first_code, jump_code);
-
-            // cleaning up registers
-            expression->free_reg();
+            // compiling statement_list code
+            compile_statements(statement_list, code);
 
-            return &code;
+            code.bind(end_label);
         }
 };
 
 // class for IF-THEN-ELSE statements, functions similarly to the if_statement class
 class if_else_statement : public statement {
     protected:
-        std::vector<statement*> *then_list;
-        std::vector<statement*> *else_list;
+        statement_vector *then_list;
+        statement_vector *else_list;
     public:
-        if_else_statement(expression_node* exp, std::vector<statement*> *then_statement, std::vector<statement*> *else_statement) :
+        if_else_statement(expression_node* exp, statement_vector *then_statement, statement_vector *else_statement) :
             then_list(then_statement), else_list(else_statement) {expression = exp; }
         void print() {
             std::cout << "IF ";
             expression->print();
             std::cout << " THEN {" << std::endl;
-            std::vector<statement*>::iterator stmt;
+            statement_vector::iterator stmt;
             for (stmt = then_list->begin(); stmt != then_list->end(); stmt++) {
                 std::cout << "\t";
                 (*stmt)->print();
@@ -541,7 +752,7 @@ class if_else_statement : public statement {
             std::cout << "Evaluating IF cond: " << expression->evaluate() << std::endl;
             if (expression->evaluate()) {
                 std::cout << "Evaluating statements: ";
-                std::vector<statement*>::iterator stmt;
+                statement_vector::iterator stmt;
                 for (stmt = then_list->begin(); stmt != then_list->end(); stmt++) {
                     (*stmt)->print();
                     (*stmt)->evaluate();
@@ -549,7 +760,7 @@ class if_else_statement : public statement {
             }
             else {
                 std::cout << "Evaluating statements: ";
-                std::vector<statement*>::iterator stmt;
+                statement_vector::iterator stmt;
                 for (stmt = else_list->begin(); stmt != else_list->end(); stmt++) {
                     (*stmt)->print();
                     (*stmt)->evaluate();
@@ -557,72 +768,64 @@ class if_else_statement : public statement {
             }
 
         }
-        std::list<std::string>* compile() {
-            std::list<std::string>* expr_code = expression->compile();
-            std::list<std::string>::iterator i;
-            for (i = expr_code->begin(); i != expr_code->end(); i++) {
-                code.push_back(*i);
-            }
-
-            // flags for looking for first code of THEN statement for JUMP
-            std::list<std::string>::iterator first_code;
-            bool is_first = true;
-
-            // looping through THEN statements
-            std::vector<statement*>::iterator stmt;
-            for (stmt = then_list->begin(); stmt != then_list->end(); stmt++) {
-                std::list<std::string>* stmt_code = (*stmt)->compile();
-                for (i = stmt_code->begin(); i != stmt_code->end(); i++) {
-                    if (is_first) {
-                        is_first = false;
-                        code.push_back(*i);
-                        first_code = --code.end();
-                    }
-                    else {
-                        code.push_back(*i);
-                    }
-                }
+        void execute(output_buffer& out) {
+            execute_statements(expression->evaluate() ? then_list : else_list, out);
+        }
+        void lower(eval_code& code) {
+            int to_else = expression->lower_branch(code, false);
+            lower_statements(then_list, code);
+            int to_end = code.emit(EVAL_JMP);
+            code.patch(to_else, code.here());
+            lower_statements(else_list, code);
+            code.patch(to_end, code.here());
+        }
+        void fold(arena& pool) {
+            expression = expression->fold(pool);
+            fold_statements(then_list, pool);
+            fold_statements(else_list, pool);
+        }
+        bool assigns(expression_node* var) { return statements_assign(then_list, var) || statements_assign(else_list, var); }
+        bool loops() { return statements_loop(then_list) || statements_loop(else_list); }
+        void compile(code_buffer& code) {
+            int known;
+            if (expression->constant(&known)) {
+                // a condition folded to a constant leaves only the branch that is taken
+                statement_vector* taken = known ? then_list : else_list;
+                compile_statements(taken, code);
+                return;
             }
+            // jump to ELSE when the condition is false
+            int else_label = code.new_label();
+            int end_label = code.new_label();
+            expression->compile_branch(code, else_label, false);
 
-            // backpatching the jump instruction to get to ELSE
-            std::string jump_code = "(JMPC, " + std::to_string(line_num + 1) + ")";
-            line_num++;
-            code.insert(first_code, jump_code);
-
-            // grabbing the last instruction of THEN to backpatch jump past ELSE
-            std::list<std::string>::iterator last_code = --code.end();
-
-            // looping through ELSE statements
-            for (stmt = else_list->begin(); stmt != else_list->end(); stmt++) {
-                std::list<std::string>* stmt_code = (*stmt)->compile();
-                for (i = stmt_code->begin(); i != stmt_code->end(); i++) {
-                    code.push_back(*i);
-                }
-            }
+            // compiling THEN statements
+            compile_statements(then_list, code);
 
-            // backpatching jump past ELSE
-            std::string jump_past_else = "(JMPC, " + std::to_string(++line_num) + ")";
-            code.insert(last_code, jump_past_else);
+            // jump past ELSE at the end of THEN
+            code.emit(ir_jump(OP_JMP, end_label));
+            code.bind(else_label);
 
-            // cleaning up registers
-            expression->free_reg();
+            // compiling ELSE statements
+            compile_statements(else_list, code);
 
-            return &code;
+            code.bind(end_label);
         }
 };
 
-// class for supporting WHILE-DO statements with jump targets backpatched after expression and 
-// DO statement compilation has occurred and been concatenated
+// class for supporting WHILE-DO statements, testing the condition after the DO statements and jumping
+// back to a label at their start while it holds
 class while_statement : public statement {
     protected:
-        std::vector<statement*> *statement_list;
+        statement_vector *statement_list;
+        expression_node* count; // trip count of a loop run on R_CNT, found by fold()
     public:
-        while_statement(expression_node* exp, std::vector<statement*> *loop_body) : statement_list(loop_body) { expression = exp; }
+        while_statement(expression_node* exp, statement_vector *loop_body) : statement_list(loop_body), count(NULL) { expression = exp; }
         void print() {
             std::cout << "WHILE ";
             expression->print();
             std::cout << " DO: {" << std::endl;
-            std::vector<statement*>::iterator stmt;
+            statement_vector::iterator stmt;
             for (stmt = statement_list->begin(); stmt != statement_list->end(); stmt++) {
                 std::cout << "\t";
                 (*stmt)->print();
@@ -633,60 +836,102 @@ class while_statement : public statement {
             std::cout << "Evaluating WHILE cond: " << expression->evaluate() << std:: endl;
             while (expression->evaluate()) {
                 std::cout << "Evaluating statements: ";
-                std::vector<statement*>::iterator stmt;
+                statement_vector::iterator stmt;
                 for (stmt = statement_list->begin(); stmt != statement_list->end(); stmt++) {
                     (*stmt)->print();
                     (*stmt)->evaluate();
                 }
             }
         }
-        std::list<std::string>* compile() {
-            // compiling expression
-            std::list<std::string>* expr_code = expression->compile();
-            std::list<std::string>::iterator i;
-            for (i = expr_code->begin(); i != expr_code->end(); i++) {
-                code.push_back(*i);
-            }
-            // grabbing line number and index of COMP instruction for backpatching jump statement if false
-            int comp_line_num = line_num;
-
-            // preparing flags to grab the first instruction of statements for backpatching jump out
-            std::list<std::string>::iterator begin_loop;
-            bool is_first = true;
+        void execute(output_buffer& out) {
+            while (expression->evaluate()) execute_statements(statement_list, out);
+        }
+        // rotated like the compiled loop, with the test at the bottom jumping back to the body
+        void lower(eval_code& code) {
+            int skip = expression->lower_branch(code, false);
+            int top = code.here();
+            lower_statements(statement_list, code);
+            code.patch(expression->lower_branch(code, true), top);
+            code.patch(skip, code.here());
+        }
+        void fold(arena& pool) {
+            expression = expression->fold(pool);
+            fold_statements(statement_list, pool);
+            count = trip_count(pool);
+        }
+        bool assigns(expression_node* var) { return statements_assign(statement_list, var); }
+        bool loops() { return true; }
 
-            // compiling statements
-            std::vector<statement*>::iterator stmt;
-            for (stmt = statement_list->begin(); stmt != statement_list->end(); stmt++) {
-                std::list<std::string>* stmt_code = (*stmt)->compile();
-                for (i = stmt_code->begin(); i != stmt_code->end(); i++) {
-                    if (is_first) {
-                        is_first = false;
-                        code.push_back(*i);
-                        begin_loop = --code.end();
-                    }
-                    else {
-                        code.push_back(*i);
-                    }
-                }
+        // Innermost loops of the form WHILE i < n DO BEGIN ...; i := i + 1 END, with a constant
+        // bound n and no other assignment to i, run a known number of times and are counted down in
+        // R_CNT with a single LOOP per iteration (i > n with i := i - 1 counts the other way).
+        // Returns the trip count expression for such loops, built in pool, or NULL. Only innermost loops qualify
+        // since there is a single counter register.
+        expression_node* trip_count(arena& pool) {
+            int mode = expression->comparison();
+            int bound;
+            if (mode < 0 || !expression->left->variable() || !expression->right->constant(&bound)) return NULL;
+            if (statement_list->empty() || statements_loop(statement_list)) return NULL;
+            expression_node* var = expression->left;
+            int step = mode == COMP_LT || mode == COMP_LTE ? 1 : -1;
+            if (!statement_list->back()->steps(var, step)) return NULL;
+            for (size_t s = 0; s + 1 < statement_list->size(); s++) {
+                if ((*statement_list)[s]->assigns(var)) return NULL;
+            }
+            // inclusive bounds at the ends of the integer range never end without wrapping
+            switch (mode) {
+                case COMP_LT: return new (pool) sub_node(new (pool) num_node(bound), var);
+                case COMP_GT: return new (pool) add_node(var, new (pool) num_node(0u - (uint32_t)bound));
+                case COMP_LTE:
+                    if (bound == INT32_MAX) return NULL;
+                    return new (pool) sub_node(new (pool) num_node(bound + 1), var);
+                default:
+                    if (bound == INT32_MIN) return NULL;
+                    return new (pool) add_node(var, new (pool) num_node(1u - (uint32_t)bound));
+            }
+        }
+        void compile(code_buffer& code) {
+            if (count) {
+                // skipping the loop when the condition starts out false, otherwise the loop body
+                // runs exactly count times (the counter is unsigned, so any 32-bit count works)
+                int top_label = code.new_label();
+                int end_label = code.new_label();
+                expression->compile_branch(code, end_label, false);
+                count->compile(code);
+                code.emit(ir_mov(REG_CNT, count->addr));
+                code.loops.push_back(loop_region{top_label, end_label});
+                code.bind(top_label);
+                compile_statements(statement_list, code);
+                code.emit(ir_jump(OP_LOOP, top_label));
+                code.bind(end_label);
+                return;
             }
-            // jumping back to top of loop
-            code.push_back("(JMP, " + std::to_string(comp_line_num) + ")");
-            line_num++;
 
-            // backpatching jump out of loop
-            std::string loop_jump = "(JMPC, " + std::to_string(++line_num + 1) + ")";
-            code.insert(begin_loop, loop_jump);
+            // a condition folded to false never runs the body, one folded to true never tests
+            int known;
+            bool constant = expression->constant(&known);
+            if (constant && !known) return;
 
-            // cleaning up registers for expression
-            expression->free_reg();
+            // the loop is rotated so the condition is tested at the bottom, jumping back to the top
+            // while it holds, with a copy of the test in front skipping the loop entirely
+            int top_label = code.new_label();
+            int end_label = code.new_label();
+            if (!constant) expression->compile_branch(code, end_label, false);
+            code.loops.push_back(loop_region{top_label, end_label});
+            code.bind(top_label);
 
-            return &code;
+            // compiling statements
+            compile_statements(statement_list, code);
+            // jumping back to top of loop
+            if (constant) code.emit(ir_jump(OP_JMP, top_label));
+            else expression->compile_branch(code, top_label, true);
+            code.bind(end_label);
         }
 };
 
 // class for handling write statements
 // compilation of this class is very simple as it only needs to provide the address
-// of the passed expression for the instruction to function correctly
+// of the compiled expression for the instruction to function correctly
 class write_statement : public statement {
     public:
         write_statement(expression_node* exp) { expression = exp; } 
@@ -698,25 +943,49 @@ class write_statement : public statement {
         void evaluate() {
             std::cout << expression->evaluate() << std::endl;
         }
-        std::list<std::string>* compile() {
-            std::string write_code = "(MEM, IO_OUT, " + expression->addr + ", STOR)";
-            code.push_back(write_code);
-            line_num++;
-            return &code;
+        void execute(output_buffer& out) { out.write_int(expression->evaluate()); }
+        void lower(eval_code& code) {
+            expression->lower(code);
+            code.emit(EVAL_WRITE);
+        }
+        void compile(code_buffer& code) {
+            expression->compile(code);
+            code.emit(ir_mem(0, expression->addr, MEM_STOR, PORT_IO_OUT));
         }
 };
 
-// overall container for recursing through the tree and concatenating the appropriate code found within
+// overall container for recursing through the tree and collecting the code of every statement into a
+// single instruction vector, only converted to text when printed
 // this class supports compilation output with line numbers for easy reference or copy-paste format
 // for direct pasting into the SAD_VM.py file included in this repository
 class program {
     protected:
-        std::vector<statement*> *statement_list; // AST representation of the program's statements
-        std::list<std::string> code; // storage for concatenated code strings
+        statement_vector *statement_list; // AST representation of the program's statements
+        std::vector<instruction> code; // compiled instructions for the whole program, labels resolved
+        std::vector<int32_t> lines; // source line of each compiled instruction, 0 for the final halt
+        arena& pool; // storage of the tree, also used for nodes created while folding
+        bool folded; // whether fold() has already run over the statements
+        int variable_count; // variables declared, numbered by slot
+        int data_words; // data memory used by the compiled code, from address 0
+        int removed; // instructions removed by the peephole optimizer
+        int dead_stores; // instructions removed by dead store elimination
     public:
-        program(std::vector<statement*> *statements) : statement_list(statements) {}
+        program(statement_vector *statements, int variables, arena& pool_) :
+            statement_list(statements), pool(pool_), folded(false), variable_count(variables), data_words(0), removed(0), dead_stores(0) {}
+        // simplifies every expression once, after which evaluate() no longer shows the tree as written
+        void fold() {
+            if (!folded) fold_statements(statement_list, pool);
+            folded = true;
+        }
+        // lowers the folded program into bytecode for the in-process evaluator
+        void lower(eval_code& code) {
+            fold();
+            code.slots = variable_count;
+            lower_statements(statement_list, code);
+            code.emit(EVAL_HALT);
+        }
         void evaluate() {
-            std::vector<statement*>::iterator i;
+            statement_vector::iterator i;
             std::cout << "Printing parsed statements:" << std::endl;
             for (i = statement_list->begin(); i != statement_list->end(); i++) {
                 (*i)->print();
@@ -725,41 +994,96 @@ class program {
             std::cout << std::endl;
 
             std::cout << "Evaluating parsed statements:" << std::endl;
-            for (i = statement_list->begin(); i != statement_list->end(); i++) {
-                (*i)->evaluate();
-                std::cout << std::endl;
+            try {
+                for (i = statement_list->begin(); i != statement_list->end(); i++) {
+                    (*i)->evaluate();
+                    std::cout << std::endl;
+                }
+            }
+            catch (const evaluation_error& error) {
+                std::cout << "Error during evaluation: " << error.message << std::endl;
             }
             std::cout << std::endl;
         }
-        void compile() {
-            std::vector<statement*>::iterator i;
+        // runs the program on the tree without tracing, returning false if evaluation failed
+        bool execute(output_buffer& out) {
+            try {
+                execute_statements(statement_list, out);
+            }
+            catch (const evaluation_error& error) {
+                out.flush();
+                std::cout << "Error during evaluation: " << error.message << std::endl;
+                return false;
+            }
+            out.flush();
+            return true;
+        }
+        // compiles the program, cleaning up the code with the peephole optimizer unless told otherwise,
+        // with each pass timed as a phase of its own when given a timer
+        void compile(bool optimize = true, pass_timer* timer = NULL) {
+            code_buffer buffer;
+            buffer.reserve_variables(variable_count);
+            // simplifying expressions first, evaluate() has already run on the tree as written
+            pass_begin(timer, "fold");
+            fold();
+            pass_begin(timer, "code generation");
+            compile_statements(statement_list, buffer);
+            // exit instruction
+            buffer.emit(ir_jump(OP_JMP, SAD_HALT));
+            removed = dead_stores = 0;
+            if (optimize) {
+                pass_begin(timer, "value numbering");
+                eliminate_common_subexpressions(buffer);
+                pass_begin(timer, "loop invariant code motion");
+                hoist_loop_invariants(buffer);
+                pass_begin(timer, "peephole (virtual registers)");
+                removed = peephole_virtual(buffer);
+                pass_begin(timer, "dead store elimination");
+                dead_stores = eliminate_dead_stores(buffer);
+            }
+            pass_begin(timer, "register allocation");
+            allocate_registers(buffer);
+            if (optimize) {
+                pass_begin(timer, "peephole (physical registers)");
+                removed += peephole_physical(buffer);
+            }
+            pass_begin(timer, "label resolution");
+            buffer.resolve_labels();
+            code.swap(buffer.code);
+            // line table mapping every instruction back to the statement it was compiled from
+            lines.resize(code.size());
+            for (size_t x = 0; x < code.size(); x++) lines[x] = code[x].line;
+            data_words = buffer.spill_slots;
+            pass_end(timer);
         /*
             // outputting compiled instructions with line numbers
-            int x = 0;
             std::cout << "Outputting compiled SADGE VM instructions:" << std::endl;
-            for (i = statement_list->begin(); i != statement_list->end(); i++) {
-                std::list<std::string>* stmt_code = (*i)->compile();
-                std::list<std::string>::iterator j;
-                for (j = stmt_code->begin(); j != stmt_code->end(); j++) {
-                    std::cout << x++ << ": " << *j << std::endl;
-                }
+            for (size_t x = 0; x < code.size(); x++) {
+                std::cout << x << ": " << ir_format(code[x]) << std::endl;
             }
-            std::cout << x << ": (JMP, None)" << std::endl;
             std::cout << std::endl;
         */
-
-            // outputting compiled instructions in copy-paste format
-            std::cout << "Copy/paste format for input into SADGE VM:" << std::endl;
-            for (i = statement_list->begin(); i != statement_list->end(); i++) {
-                std::list<std::string>* stmt_code = (*i)->compile();
-                std::list<std::string>::iterator j;
-                for (j = stmt_code->begin(); j != stmt_code->end(); j++) {
-                    std::cout << *j << "," << std::endl;
-                }
+        }
+        // outputs the compiled instructions in copy-paste format, which the native VM's assembler
+        // reads back as well
+        void print_code(std::ostream& out) {
+            for (size_t x = 0; x + 1 < code.size(); x++) {
+                out << ir_format(code[x]) << ",\n";
             }
-            // outputting exit instruction 
-            std::cout << "(JMP, None)" << std::endl;
+            out << ir_format(code.back()) << "\n";
+        }
+        // packs the compiled code into an object file image with a zeroed data section
+        sad_image get_image() {
+            sad_image image;
+            for (size_t x = 0; x < code.size(); x++) image.code.push_back(ir_encode(code[x]));
+            image.data.assign(data_words, 0);
+            image.lines = lines;
+            return image;
         }
+        std::vector<instruction>* get_code() { return &code; }
+        const std::vector<int32_t>& get_lines() const { return lines; }
+        int get_removed() const { return removed; }
+        int get_dead_stores() const { return dead_stores; }
 };
 
-extern std::map<std::string, var_node *> symbols;
+#endif
@@ -0,0 +1,227 @@
+/*
+IR.h
+Author: Kristopher J. Carroll
+Description:
+    Typed instruction representation emitted by the compile() functions in AST.h. Each instruction
+    holds its SAD VM op code, mode, register operands and immediate value, and the whole program is
+    compiled into a single contiguous vector owned by the program class. Instruction text in the
+    "(OP, arg, ...)" copy-paste format is only produced when the program is printed, and the packed
+    words executed by the native VM are produced directly from the same vector.
+
+    Jumps are emitted against symbolic labels rather than instruction indices. A label is bound by
+    placing a LABEL pseudo-instruction in the buffer, and a single fix-up pass at the end of
+    compilation removes the markers and rewrites every jump to the index of its label, so code can be
+    emitted and rearranged freely before the final addresses are known.
+
+    Every instruction also records the source line of the statement it was compiled from, which the
+    passes after code generation carry along (spill code takes the line of the instruction it
+    serves), so the finished program has a line table for the profiler to map addresses back to.
+
+    Register operands below IR_VREG_BASE are physical SAD VM registers. Code generation works on an
+    unbounded supply of virtual registers at or above IR_VREG_BASE, which the register allocator
+    (regalloc.h) maps onto physical registers or spill slots in data memory.
+*/
+
+#ifndef IR_H
+#define IR_H
+
+#include <string>
+#include <vector>
+#include "SAD_VM.h"
+
+// pseudo op code marking the position of a label, never present after label resolution
+const uint8_t IR_LABEL = 0x10;
+
+struct instruction {
+    uint8_t op; // sad_opcode
+    uint8_t mode; // math, comparison, memory or stack mode
+    uint8_t port; // port selector for MEM instructions
+    int a, b, c; // register operands
+    int32_t imm; // immediate value, jump target label or label id for LABEL
+    int line; // source line of the statement the instruction was compiled from, 0 if none
+};
+
+// first virtual register number, everything below is a physical SAD VM register
+const int IR_VREG_BASE = 16;
+inline bool ir_is_vreg(int reg) { return reg >= IR_VREG_BASE; }
+
+// true for instructions whose immediate is a jump target
+inline bool ir_is_jump(const instruction& i) {
+    return i.op == OP_LOOP || i.op == OP_JMP || i.op == OP_JMPC || i.op == OP_JMPR;
+}
+
+// comparison mode testing the opposite condition
+inline int ir_invert_comp(int mode) {
+    switch (mode) {
+        case COMP_EQ: return COMP_NEQ;
+        case COMP_NEQ: return COMP_EQ;
+        case COMP_LT: return COMP_GTE;
+        case COMP_GTE: return COMP_LT;
+        case COMP_GT: return COMP_LTE;
+        default: return COMP_GT;
+    }
+}
+
+// helpers for building instructions, mirroring the encoders in SAD_VM.h
+inline instruction ir_make(int op, int a, int b, int c, int mode, int32_t imm) {
+    instruction i;
+    i.op = op;
+    i.mode = mode;
+    i.port = PORT_NONE;
+    i.a = a;
+    i.b = b;
+    i.c = c;
+    i.imm = imm;
+    i.line = 0;
+    return i;
+}
+inline instruction ir_mov(int dst, int src) { return ir_make(OP_MOV, dst, src, 0, 0, 0); }
+inline instruction ir_limm(int dst, int32_t imm) { return ir_make(OP_LIMM, dst, 0, 0, 0, imm); }
+inline instruction ir_math(int dst, int src1, int src2, int mode) { return ir_make(OP_MATH, dst, src1, src2, mode, 0); }
+inline instruction ir_mathi(int dst, int mode, int32_t imm) { return ir_make(OP_MATHI, dst, 0, 0, mode, imm); }
+inline instruction ir_comp(int a, int b, int mode) { return ir_make(OP_COMP, a, b, 0, mode, 0); }
+inline instruction ir_jump(int op, int32_t target) { return ir_make(op, 0, 0, 0, 0, target); }
+inline instruction ir_reg(int op, int reg) { return ir_make(op, reg, 0, 0, 0, 0); }
+inline instruction ir_mem(int a, int b, int mode, int port) {
+    instruction i = ir_make(OP_MEM, a, b, 0, mode, 0);
+    i.port = port;
+    return i;
+}
+// applies an immediate operand to a register in place, using INC/DEC for adding or subtracting one
+inline instruction ir_immediate(int reg, int mode, int32_t imm) {
+    if ((mode == MATH_ADD && imm == 1) || (mode == MATH_SUB && imm == -1)) return ir_reg(OP_INC, reg);
+    if ((mode == MATH_ADD && imm == -1) || (mode == MATH_SUB && imm == 1)) return ir_reg(OP_DEC, reg);
+    return ir_mathi(reg, mode, imm);
+}
+inline instruction ir_label(int label) { return ir_make(IR_LABEL, 0, 0, 0, 0, label); }
+// the same instruction attributed to the given source line, for instructions replacing or
+// serving one already in the buffer
+inline instruction ir_at(instruction i, int line) {
+    i.line = line;
+    return i;
+}
+
+// register operands read by an instruction, returning how many were stored in uses
+inline int ir_uses(instruction& i, int** uses) {
+    switch (i.op) {
+        case OP_MOV: uses[0] = &i.b; return 1;
+        case OP_MATH: uses[0] = &i.b; uses[1] = &i.c; return 2;
+        case OP_MATHI:
+        case OP_INC:
+        case OP_DEC: uses[0] = &i.a; return 1;
+        case OP_COMP: uses[0] = &i.a; uses[1] = &i.b; return 2;
+        case OP_MEM:
+            if (i.mode == MEM_STOR && i.port == PORT_NONE) { uses[0] = &i.a; uses[1] = &i.b; return 2; }
+            if (i.mode == MEM_STOR) { uses[0] = &i.b; return 1; }
+            if (i.port == PORT_NONE) { uses[0] = &i.b; return 1; }
+            return 0;
+        case OP_STCK:
+            if (i.mode == STCK_PUSH) { uses[0] = &i.a; return 1; }
+            return 0;
+        default: return 0;
+    }
+}
+
+// register operand written by an instruction, or NULL
+inline int* ir_def(instruction& i) {
+    switch (i.op) {
+        case OP_MOV:
+        case OP_LIMM:
+        case OP_MATH:
+        case OP_MATHI:
+        case OP_INC:
+        case OP_DEC: return &i.a;
+        case OP_MEM: return i.mode == MEM_LOAD ? &i.a : NULL;
+        case OP_STCK: return i.mode == STCK_POP ? &i.a : NULL;
+        default: return NULL;
+    }
+}
+
+// whether removing i when nothing reads its result keeps the program's behaviour, division is kept
+// since it can fault and reading the input port consumes input
+inline bool ir_removable(const instruction& i) {
+    switch (i.op) {
+        case OP_LIMM:
+        case OP_MOV:
+        case OP_INC:
+        case OP_DEC: return true;
+        case OP_MATH:
+        case OP_MATHI: return i.mode != MATH_DIV;
+        case OP_MEM: return i.mode == MEM_LOAD && i.port == PORT_NONE;
+        default: return false;
+    }
+}
+
+// a WHILE loop body, from the label at its head to the label at its exit
+struct loop_region {
+    int head;
+    int exit;
+};
+
+// instruction buffer shared by all compile() functions of a program
+class code_buffer {
+    protected:
+        int label_count;
+    public:
+        std::vector<instruction> code;
+        std::vector<uint8_t> variables; // per virtual register, whether it holds a program variable
+        std::vector<loop_region> loops; // every loop emitted, outer loops before the loops they contain
+        int variable_count; // program variables, holding the first virtual registers in slot order
+        int spill_slots; // data memory words used by the register allocator
+        int line; // source line of the statement being compiled, recorded on everything emitted
+
+        code_buffer() : label_count(0), variable_count(0), spill_slots(0), line(0) { }
+        // gives the program variables the virtual registers IR_VREG_BASE + slot, before any temporaries
+        void reserve_variables(int count) {
+            for (int v = 0; v < count; v++) new_vreg(true);
+            variable_count = count;
+        }
+        void emit(const instruction& i) { code.push_back(ir_at(i, line)); }
+        int new_label() { return label_count++; }
+        int labels() const { return label_count; }
+        void bind(int label) { code.push_back(ir_label(label)); }
+        int new_vreg(bool variable = false) {
+            variables.push_back(variable);
+            return IR_VREG_BASE + variables.size() - 1;
+        }
+        int vregs() const { return variables.size(); }
+
+        // fix-up pass replacing label operands with instruction indices and dropping the LABEL
+        // markers, jumps to SAD_HALT (None) are left untouched
+        void resolve_labels() {
+            std::vector<int32_t> target(label_count, SAD_HALT);
+            size_t index = 0;
+            for (size_t i = 0; i < code.size(); i++) {
+                if (code[i].op == IR_LABEL) target[code[i].imm] = index;
+                else index++;
+            }
+            size_t out = 0;
+            for (size_t i = 0; i < code.size(); i++) {
+                if (code[i].op == IR_LABEL) continue;
+                if (ir_is_jump(code[i]) && (uint32_t)code[i].imm != SAD_HALT) code[i].imm = target[code[i].imm];
+                code[out++] = code[i];
+            }
+            code.resize(out);
+        }
+};
+
+// packs an instruction into its 32-bit SAD VM word
+inline uint32_t ir_encode(const instruction& i) {
+    switch (i.op) {
+        case OP_MOV: return sad_mov(i.a, i.b);
+        case OP_MEM: return sad_mem(i.a, i.b, i.mode, i.port);
+        case OP_LIMM: return sad_limm(i.a, i.imm);
+        case OP_MATH: return sad_math(i.a, i.b, i.c, i.mode);
+        case OP_MATHI: return sad_mathi(i.a, i.mode, i.imm);
+        case OP_COMP: return sad_comp(i.a, i.b, i.mode);
+        case OP_INC:
+        case OP_DEC: return sad_reg(i.op, i.a);
+        case OP_STCK: return sad_stck(i.a, i.mode);
+        default: return sad_target(i.op, i.imm);
+    }
+}
+
+// produces the copy-paste tuple text for an instruction
+inline std::string ir_format(const instruction& i) { return sad_disassemble(ir_encode(i)); }
+
+#endif
@@ -0,0 +1,793 @@
+/*
+SAD_VM.cpp
+Author: Kristopher J. Carroll
+Description:
+    Assembler, disassembler, object file reader and writer, execution loop and profile report for the
+    native SAD VM described in SAD_VM.h.
+*/
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <map>
+#include "SAD_VM.h"
+
+// symbolic names accepted by the assembler, with the same values as the constants in SAD_VM.py
+static const std::map<std::string, int64_t>& sad_names() {
+    static const std::map<std::string, int64_t> names = {
+        {"MOV", OP_MOV}, {"MEM", OP_MEM}, {"LIMM", OP_LIMM}, {"MATH", OP_MATH}, {"MATHI", OP_MATHI},
+        {"COMP", OP_COMP}, {"LOG", OP_LOG}, {"CNT", OP_CNT}, {"LOOP", OP_LOOP}, {"JMP", OP_JMP},
+        {"JMPC", OP_JMPC}, {"JMPR", OP_JMPR}, {"RET", OP_RET}, {"INC", OP_INC}, {"DEC", OP_DEC},
+        {"STCK", OP_STCK},
+        {"ADD", MATH_ADD}, {"SUB", MATH_SUB}, {"MULT", MATH_MULT}, {"DIV", MATH_DIV},
+        {"LOAD", MEM_LOAD}, {"STOR", MEM_STOR},
+        {"PUSH", STCK_PUSH}, {"POP", STCK_POP},
+        {"EQ", COMP_EQ}, {"NEQ", COMP_NEQ}, {"LT", COMP_LT}, {"GT", COMP_GT}, {"LTE", COMP_LTE}, {"GTE", COMP_GTE},
+        {"PC", REG_PC}, {"R_CNT", REG_CNT},
+        {"R_0", REG_R0}, {"R_1", REG_R1}, {"R_2", REG_R2}, {"R_3", REG_R3}, {"R_4", REG_R4},
+        {"R_5", REG_R5}, {"R_6", REG_R6}, {"R_7", REG_R7}, {"R_8", REG_R8}, {"R_9", REG_R9},
+        {"R_10", REG_R10}, {"R_11", REG_R11}, {"R_12", REG_R12}, {"R_13", REG_R13},
+        {"IO_OUT", SAD_IO_OUT}, {"None", SAD_HALT}
+    };
+    return names;
+}
+
+static const char* reg_names[16] = {
+    "PC", "R_CNT", "R_0", "R_1", "R_2", "R_3", "R_4", "R_5",
+    "R_6", "R_7", "R_8", "R_9", "R_10", "R_11", "R_12", "R_13"
+};
+static const char* op_names[16] = {
+    "MOV", "MEM", "LIMM", "MATH", "MATHI", "COMP", "LOG", "CNT",
+    "LOOP", "JMP", "JMPC", "JMPR", "RET", "INC", "DEC", "STCK"
+};
+static const char* math_names[4] = { "ADD", "SUB", "MULT", "DIV" };
+static const char* comp_names[8] = { "EQ", "NEQ", "LT", "GT", "LTE", "GTE", "?", "?" };
+
+// parses a single tuple operand, either a symbolic name or a (possibly negative or hex) integer
+static bool parse_operand(const std::string& tok, int64_t& value) {
+    std::map<std::string, int64_t>::const_iterator name = sad_names().find(tok);
+    if (name != sad_names().end()) {
+        value = name->second;
+        return true;
+    }
+    if (tok.empty()) return false;
+    char* end;
+    value = strtoll(tok.c_str(), &end, 0);
+    return *end == '\0';
+}
+
+// encodes one parsed tuple, args[0] being the op code
+static bool encode(const std::vector<int64_t>& args, uint32_t& word, std::string& error) {
+    static const size_t arity[16] = { 2, 3, 2, 4, 3, 3, 0, 1, 1, 1, 1, 1, 0, 1, 1, 2 };
+    int64_t op = args[0];
+    if (op < 0 || op > 0xf || op == OP_LOG) {
+        error = "unsupported op code";
+        return false;
+    }
+    if (args.size() - 1 != arity[op]) {
+        error = std::string("wrong operand count for ") + op_names[op];
+        return false;
+    }
+    // register operands by op code, checked before encoding
+    for (size_t i = 1; i < args.size(); i++) {
+        bool is_reg = (op == OP_MOV) || (op == OP_MATH && i < 4) || (op == OP_MATHI && i == 1) ||
+                      (op == OP_LIMM && i == 1) || (op == OP_COMP && i < 3) || op == OP_INC ||
+                      op == OP_DEC || (op == OP_STCK && i == 1);
+        if (is_reg && (args[i] < 0 || args[i] > 0xf)) {
+            error = std::string("register operand out of range for ") + op_names[op];
+            return false;
+        }
+    }
+    switch (op) {
+        case OP_MOV: word = sad_mov(args[1], args[2]); break;
+        case OP_MEM: {
+            int64_t dst = args[1], src = args[2], mode = args[3];
+            int port = PORT_NONE;
+            if (mode == MEM_STOR && dst == SAD_IO_OUT) { port = PORT_IO_OUT; dst = 0; }
+            else if (mode == MEM_STOR && dst == SAD_IO_CHAR) { port = PORT_IO_CHAR; dst = 0; }
+            else if (mode == MEM_LOAD && src == SAD_IO_IN) { port = PORT_IO_IN; src = 0; }
+            if (dst < 0 || dst > 0xf || src < 0 || src > 0xf || (mode != MEM_LOAD && mode != MEM_STOR)) {
+                error = "bad MEM operands";
+                return false;
+            }
+            word = sad_mem(dst, src, mode, port);
+            break;
+        }
+        case OP_LIMM:
+            if (args[2] < SAD_LIMM_MIN || args[2] > SAD_LIMM_MAX) {
+                error = "LIMM immediate out of range";
+                return false;
+            }
+            word = sad_limm(args[1], args[2]);
+            break;
+        case OP_MATH:
+            if (args[4] < 0 || args[4] > MATH_DIV) { error = "math mode flag not found"; return false; }
+            word = sad_math(args[1], args[2], args[3], args[4]);
+            break;
+        case OP_MATHI:
+            if (args[2] < 0 || args[2] > MATH_DIV) { error = "math mode flag not found"; return false; }
+            if (args[3] < SAD_MATHI_MIN || args[3] > SAD_MATHI_MAX) { error = "MATHI immediate out of range"; return false; }
+            word = sad_mathi(args[1], args[2], args[3]);
+            break;
+        case OP_COMP:
+            if (args[3] < 0 || args[3] > COMP_GTE) { error = "comparison mode flag not found"; return false; }
+            word = sad_comp(args[1], args[2], args[3]);
+            break;
+        case OP_CNT:
+        case OP_LOOP:
+        case OP_JMP:
+        case OP_JMPC:
+        case OP_JMPR:
+            if (args[1] < 0 || args[1] > SAD_HALT) { error = "target out of range"; return false; }
+            word = sad_target(op, args[1]);
+            break;
+        case OP_RET: word = sad_target(OP_RET, 0); break;
+        case OP_INC:
+        case OP_DEC: word = sad_reg(op, args[1]); break;
+        case OP_STCK:
+            if (args[2] != STCK_PUSH && args[2] != STCK_POP) { error = "stack mode flag not found"; return false; }
+            word = sad_stck(args[1], args[2]);
+            break;
+    }
+    return true;
+}
+
+bool sad_assemble(const std::string& text, std::vector<uint32_t>& words, std::string& error) {
+    size_t pos = 0;
+    int tuple = 0;
+    while (true) {
+        // skipping comments and any text between tuples
+        size_t open = text.find_first_of("(#", pos);
+        if (open == std::string::npos) break;
+        if (text[open] == '#') {
+            pos = text.find('\n', open);
+            if (pos == std::string::npos) break;
+            continue;
+        }
+        size_t close = text.find(')', open);
+        if (close == std::string::npos) {
+            error = "unterminated instruction tuple";
+            return false;
+        }
+        // splitting the tuple on commas and whitespace
+        std::vector<int64_t> args;
+        std::string tok;
+        for (size_t i = open + 1; i <= close; i++) {
+            char c = text[i];
+            if (c == ',' || c == ')' || c == ' ' || c == '\t' || c == '\n' || c == '\r') {
+                if (!tok.empty()) {
+                    int64_t value;
+                    if (!parse_operand(tok, value)) {
+                        error = "unknown operand '" + tok + "' in instruction " + std::to_string(tuple);
+                        return false;
+                    }
+                    args.push_back(value);
+                    tok.clear();
+                }
+            }
+            else {
+                tok += c;
+            }
+        }
+        if (args.empty()) {
+            error = "empty instruction tuple " + std::to_string(tuple);
+            return false;
+        }
+        uint32_t word;
+        if (!encode(args, word, error)) {
+            error += " in instruction " + std::to_string(tuple);
+            return false;
+        }
+        words.push_back(word);
+        tuple++;
+        pos = close + 1;
+    }
+    return true;
+}
+
+static std::string target_text(uint32_t w) {
+    uint32_t target = w & SAD_HALT;
+    return target == SAD_HALT ? "None" : std::to_string(target);
+}
+
+std::string sad_disassemble(uint32_t w) {
+    std::string op = op_names[sad_op(w)];
+    switch (sad_op(w)) {
+        case OP_MOV:
+            return "(" + op + ", " + reg_names[sad_a(w)] + ", " + reg_names[sad_b(w)] + ")";
+        case OP_MEM: {
+            int mode = (w >> 19) & 1;
+            int port = (w >> 17) & 3;
+            std::string dst = reg_names[sad_a(w)];
+            std::string src = reg_names[sad_b(w)];
+            if (port == PORT_IO_OUT) dst = "IO_OUT";
+            else if (port == PORT_IO_CHAR) dst = "0xffff0001";
+            else if (port == PORT_IO_IN) src = "0xff00";
+            return "(" + op + ", " + dst + ", " + src + ", " + (mode == MEM_LOAD ? "LOAD" : "STOR") + ")";
+        }
+        case OP_LIMM:
+            return "(" + op + ", " + reg_names[sad_a(w)] + ", " + std::to_string(sad_signed(w, 24)) + ")";
+        case OP_MATH:
+            return "(" + op + ", " + reg_names[sad_a(w)] + ", " + reg_names[sad_b(w)] + ", " +
+                   reg_names[sad_c(w)] + ", " + math_names[w & 3] + ")";
+        case OP_MATHI:
+            return "(" + op + ", " + reg_names[sad_a(w)] + ", " + math_names[(w >> 22) & 3] + ", " +
+                   std::to_string(sad_signed(w, 22)) + ")";
+        case OP_COMP:
+            return "(" + op + ", " + reg_names[sad_a(w)] + ", " + reg_names[sad_b(w)] + ", " + comp_names[w & 7] + ")";
+        case OP_CNT:
+            return "(" + op + ", " + std::to_string(w & SAD_HALT) + ")";
+        case OP_LOOP:
+        case OP_JMP:
+        case OP_JMPC:
+        case OP_JMPR:
+            return "(" + op + ", " + target_text(w) + ")";
+        case OP_RET:
+            return "(" + op + ",)";
+        case OP_INC:
+        case OP_DEC:
+            return "(" + op + ", " + reg_names[sad_a(w)] + ")";
+        case OP_STCK:
+            return "(" + op + ", " + reg_names[sad_a(w)] + ", " + ((w & 1) == STCK_PUSH ? "PUSH" : "POP") + ")";
+    }
+    return "(" + op + ")";
+}
+
+static void put_word(std::vector<unsigned char>& out, uint32_t word) {
+    for (int shift = 0; shift < 32; shift += 8) out.push_back((word >> shift) & 0xff);
+}
+
+static uint32_t get_word(const unsigned char* in) {
+    return in[0] | (in[1] << 8) | (in[2] << 16) | ((uint32_t)in[3] << 24);
+}
+
+bool sad_write_image(const std::string& path, const sad_image& image, std::string& error) {
+    std::vector<unsigned char> bytes;
+    bytes.reserve(4 * (SAD_IMAGE_HEADER_WORDS + image.code.size() + image.data.size()));
+    put_word(bytes, SAD_IMAGE_MAGIC);
+    put_word(bytes, SAD_IMAGE_VERSION);
+    put_word(bytes, image.code.size());
+    put_word(bytes, image.data_base);
+    put_word(bytes, image.data.size());
+    for (size_t i = 0; i < image.code.size(); i++) put_word(bytes, image.code[i]);
+    for (size_t i = 0; i < image.data.size(); i++) put_word(bytes, image.data[i]);
+    FILE* out = fopen(path.c_str(), "wb");
+    if (!out) {
+        error = "could not open " + path;
+        return false;
+    }
+    bool written = fwrite(bytes.data(), 1, bytes.size(), out) == bytes.size();
+    if (fclose(out) != 0) written = false;
+    if (!written) error = "could not write " + path;
+    return written;
+}
+
+bool sad_read_image(const std::string& path, sad_image& image, std::string& error) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        error = "could not open " + path;
+        return false;
+    }
+    struct stat info;
+    size_t size = fstat(fd, &info) == 0 ? info.st_size : 0;
+    void* mapping = size ? mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+    const size_t header = 4 * SAD_IMAGE_HEADER_WORDS;
+    if (mapping == MAP_FAILED || size < header) {
+        if (mapping != MAP_FAILED) munmap(mapping, size);
+        error = path + " is not a SAD VM object file";
+        return false;
+    }
+    const unsigned char* bytes = (const unsigned char*)mapping;
+    uint32_t code_words = get_word(bytes + 8), data_base = get_word(bytes + 12), data_words = get_word(bytes + 16);
+    bool ok = true;
+    // a data section past the largest memory the VM is given by default cannot be a program's
+    if (get_word(bytes) != SAD_IMAGE_MAGIC || (uint64_t)data_base + data_words > SAD_MEMORY_WORDS) {
+        error = path + " is not a SAD VM object file";
+        ok = false;
+    }
+    else if (get_word(bytes + 4) != SAD_IMAGE_VERSION) {
+        error = path + " has an unsupported object file version";
+        ok = false;
+    }
+    else if (size - header != 4 * ((uint64_t)code_words + data_words)) {
+        error = path + " does not match the section sizes in its header";
+        ok = false;
+    }
+    else {
+        const unsigned char* at = bytes + header;
+        image.code.resize(code_words);
+        for (uint32_t i = 0; i < code_words; i++, at += 4) image.code[i] = get_word(at);
+        image.data_base = data_base;
+        image.data.resize(data_words);
+        for (uint32_t i = 0; i < data_words; i++, at += 4) image.data[i] = get_word(at);
+    }
+    munmap(mapping, size);
+    return ok;
+}
+
+void sad_vm::reset() {
+    memset(regs, 0, sizeof(regs));
+    cond = 0;
+    ra = 0;
+    executed = 0;
+    std::fill(mem.begin(), mem.end(), 0);
+    stack_top = 0;
+    error_msg.clear();
+}
+
+bool sad_vm::fault(const std::string& msg, uint32_t pc) {
+    error_msg = msg + " at instruction " + std::to_string(pc);
+    return false;
+}
+
+// the next value for the input port, flushing output first when it comes from stdin since anything
+// written so far may be a prompt for it
+bool sad_vm::read_input(int32_t& value) {
+    if (input) {
+        if (input_next == input_size) return false;
+        value = input[input_next++];
+        return true;
+    }
+    out.flush();
+    return scanf("%d", &value) == 1;
+}
+
+bool sad_vm::unsupported(uint32_t pc) {
+    return fault(std::string("unsupported op code ") + op_names[sad_op(program[pc])], pc);
+}
+
+// executes a single instruction word with regs[PC] already advanced past it, used for
+// instructions that read or write PC as an ordinary register operand
+bool sad_vm::step(uint32_t w, uint32_t pc) {
+    int a = sad_a(w);
+    int b = sad_b(w);
+    switch (sad_op(w)) {
+        case OP_MOV:
+            regs[a] = regs[b];
+            break;
+        case OP_MEM: {
+            int port = (w >> 17) & 3;
+            if ((w >> 19) & 1) { // STOR
+                if (port == PORT_IO_OUT) out.write_int(regs[b]);
+                else if (port == PORT_IO_CHAR) out.write_char(regs[b] == 0 ? '\n' : regs[b]);
+                else if ((uint32_t)regs[a] < mem.size()) mem[regs[a]] = regs[b];
+                else return fault("data memory address out of range", pc);
+            }
+            else { // LOAD
+                if (port == PORT_IO_IN) {
+                    if (!read_input(regs[a])) return fault("no input available", pc);
+                }
+                else if ((uint32_t)regs[b] < mem.size()) regs[a] = mem[regs[b]];
+                else return fault("data memory address out of range", pc);
+            }
+            break;
+        }
+        case OP_LIMM:
+            regs[a] = sad_signed(w, 24);
+            break;
+        case OP_MATH: {
+            uint32_t x = regs[b], y = regs[sad_c(w)];
+            switch (w & 3) {
+                case MATH_ADD: regs[a] = x + y; break;
+                case MATH_SUB: regs[a] = x - y; break;
+                case MATH_MULT: regs[a] = x * y; break;
+                case MATH_DIV:
+                    if (y == 0) return fault("division by zero", pc);
+                    regs[a] = sad_div(x, y);
+                    break;
+            }
+            break;
+        }
+        case OP_MATHI: {
+            uint32_t x = regs[a], imm = sad_signed(w, 22);
+            switch ((w >> 22) & 3) {
+                case MATH_ADD: regs[a] = x + imm; break;
+                case MATH_SUB: regs[a] = x - imm; break;
+                case MATH_MULT: regs[a] = x * imm; break;
+                case MATH_DIV:
+                    if (imm == 0) return fault("division by zero", pc);
+                    regs[a] = sad_div(x, imm);
+                    break;
+            }
+            break;
+        }
+        case OP_COMP: {
+            int32_t x = regs[a], y = regs[b];
+            switch (w & 7) {
+                case COMP_EQ: cond = x == y; break;
+                case COMP_NEQ: cond = x != y; break;
+                case COMP_LT: cond = x < y; break;
+                case COMP_GT: cond = x > y; break;
+                case COMP_LTE: cond = x <= y; break;
+                case COMP_GTE: cond = x >= y; break;
+                default: return fault("comparison mode flag not found", pc);
+            }
+            break;
+        }
+        case OP_INC:
+            regs[a] = (uint32_t)regs[a] + 1;
+            break;
+        case OP_DEC:
+            regs[a] = (uint32_t)regs[a] - 1;
+            break;
+        case OP_STCK:
+            if ((w & 1) == STCK_PUSH) {
+                if (stack_top == stack.size()) return fault("push onto full stack", pc);
+                stack[stack_top++] = regs[a];
+            }
+            else {
+                if (stack_top == 0) return fault("pop from empty stack", pc);
+                regs[a] = stack[--stack_top];
+            }
+            break;
+        default:
+            return fault(std::string("unsupported op code ") + op_names[sad_op(w)], pc);
+    }
+    return true;
+}
+
+// the superinstruction executing first and the instruction after it, first itself if there is none
+static uint8_t superinstruction(uint8_t first, uint8_t second) {
+    if (first >= H_EQ && first <= H_GTE && second == H_JMPC) return H_EQ_JMPC + (first - H_EQ);
+    if (first == H_LIMM && second == H_LOAD) return H_LIMM_LOAD;
+    if (first == H_LIMM && second == H_STOR) return H_LIMM_STOR;
+    if (first == H_LIMM && second >= H_ADD && second <= H_MULT) return H_LIMM_ADD + (second - H_ADD);
+    if (first >= H_ADD && first <= H_MULT && second == H_MOV) return H_ADD_MOV + (first - H_ADD);
+    return first;
+}
+
+void sad_decode(const std::vector<uint32_t>& program, std::vector<sad_decoded>& decoded) {
+    uint32_t size = program.size();
+    decoded.resize(size + 1);
+    for (uint32_t pc = 0; pc <= size; pc++) {
+        sad_decoded& d = decoded[pc];
+        d.label = NULL;
+        d.a = d.b = d.c = 0;
+        d.imm = 0;
+        if (pc == size) {
+            d.handler = H_HALT;
+            break;
+        }
+        uint32_t w = program[pc];
+        d.a = sad_a(w);
+        d.b = sad_b(w);
+        d.c = sad_c(w);
+        // jump targets past the end (including None) resolve to the trailing HALT
+        uint32_t target = w & SAD_HALT;
+        bool uses_pc = false;
+        switch (sad_op(w)) {
+            case OP_MOV:
+                d.handler = H_MOV;
+                uses_pc = d.a == REG_PC || d.b == REG_PC;
+                break;
+            case OP_MEM: {
+                int port = (w >> 17) & 3;
+                if ((w >> 19) & 1) {
+                    d.handler = port == PORT_IO_OUT ? H_OUT : port == PORT_IO_CHAR ? H_CHAR : H_STOR;
+                    uses_pc = d.b == REG_PC || (port == PORT_NONE && d.a == REG_PC);
+                }
+                else {
+                    d.handler = port == PORT_IO_IN ? H_IN : H_LOAD;
+                    uses_pc = d.a == REG_PC || (port == PORT_NONE && d.b == REG_PC);
+                }
+                break;
+            }
+            case OP_LIMM:
+                d.handler = H_LIMM;
+                d.imm = sad_signed(w, 24);
+                uses_pc = d.a == REG_PC;
+                break;
+            case OP_MATH:
+                d.handler = H_ADD + (w & 3);
+                uses_pc = d.a == REG_PC || d.b == REG_PC || d.c == REG_PC;
+                break;
+            case OP_MATHI:
+                d.handler = H_ADDI + ((w >> 22) & 3);
+                d.imm = sad_signed(w, 22);
+                uses_pc = d.a == REG_PC;
+                break;
+            case OP_COMP:
+                d.handler = (w & 7) <= COMP_GTE ? H_EQ + (w & 7) : H_BAD;
+                uses_pc = d.a == REG_PC || d.b == REG_PC;
+                break;
+            case OP_CNT:
+                d.handler = H_CNT;
+                d.imm = target;
+                break;
+            case OP_LOOP:
+            case OP_JMP:
+            case OP_JMPC:
+            case OP_JMPR:
+                d.handler = sad_op(w) == OP_LOOP ? H_LOOP : sad_op(w) == OP_JMP ? H_JMP :
+                            sad_op(w) == OP_JMPC ? H_JMPC : H_JMPR;
+                d.imm = target < size ? target : size;
+                break;
+            case OP_RET:
+                d.handler = H_RET;
+                break;
+            case OP_INC:
+            case OP_DEC:
+                d.handler = sad_op(w) == OP_INC ? H_INC : H_DEC;
+                uses_pc = d.a == REG_PC;
+                break;
+            case OP_STCK:
+                d.handler = (w & 1) == STCK_PUSH ? H_PUSH : H_POP;
+                uses_pc = d.a == REG_PC;
+                break;
+            default:
+                d.handler = H_BAD;
+                break;
+        }
+        if (uses_pc) d.handler = H_SLOW;
+    }
+    for (uint32_t pc = 0; pc <= size; pc++) {
+        decoded[pc].dispatch = pc < size ? superinstruction(decoded[pc].handler, decoded[pc + 1].handler) : H_HALT;
+    }
+}
+
+void sad_vm::decode() {
+    sad_decode(program, decoded);
+    bound = NULL;
+}
+
+#if (defined(__GNUC__) || defined(__clang__)) && !defined(SAD_VM_SWITCH_DISPATCH)
+#define SAD_VM_THREADED 1
+#endif
+
+// handler bodies are shared between both dispatch strategies
+#ifdef SAD_VM_THREADED
+#define VM_CASE(name) L_##name: if (profiling) hits[ip - code]++;
+#define VM_NEXT do { count++; goto *ip->label; } while (0)
+#define VM_NEXT_PAIR do { count += 2; goto *ip->label; } while (0)
+#else
+#define VM_CASE(name) case H_##name: if (profiling) hits[ip - code]++;
+#define VM_NEXT do { count++; goto next; } while (0)
+#define VM_NEXT_PAIR do { count += 2; goto next; } while (0)
+#endif
+
+template <bool profiling> bool sad_vm::execute(uint64_t* hits, uint64_t* taken) {
+    if (decoded.empty()) decode();
+#ifdef SAD_VM_THREADED
+    // each copy of the loop has its own handler addresses, so the labels are bound again on a switch
+    #define SAD_HANDLER_LABEL(name) &&L_##name,
+    static const void* const labels[H_COUNT] = { SAD_HANDLERS(SAD_HANDLER_LABEL) };
+    #undef SAD_HANDLER_LABEL
+    if (bound != labels) {
+        for (size_t i = 0; i < decoded.size(); i++) {
+            decoded[i].label = labels[profiling ? decoded[i].handler : decoded[i].dispatch];
+        }
+        bound = labels;
+    }
+#endif
+    sad_decoded* code = decoded.data();
+    uint32_t size = program.size();
+    uint32_t start = regs[REG_PC];
+    const sad_decoded* ip = code + (start < size ? start : size);
+    int32_t* r = regs;
+    int32_t* memory = mem.data();
+    uint32_t memory_size = mem.size();
+    uint64_t count = 0;
+    bool ok = true;
+
+#ifdef SAD_VM_THREADED
+    goto *ip->label;
+#else
+    next:
+    switch (profiling ? ip->handler : ip->dispatch) {
+#endif
+        VM_CASE(MOV) r[ip->a] = r[ip->b]; ip++; VM_NEXT;
+        VM_CASE(LOAD)
+            if ((uint32_t)r[ip->b] >= memory_size) { ok = fault("data memory address out of range", ip - code); goto done; }
+            r[ip->a] = memory[r[ip->b]];
+            ip++;
+            VM_NEXT;
+        VM_CASE(STOR)
+            if ((uint32_t)r[ip->a] >= memory_size) { ok = fault("data memory address out of range", ip - code); goto done; }
+            memory[r[ip->a]] = r[ip->b];
+            ip++;
+            VM_NEXT;
+        VM_CASE(OUT) out.write_int(r[ip->b]); ip++; VM_NEXT;
+        VM_CASE(CHAR) out.write_char(r[ip->b] == 0 ? '\n' : r[ip->b]); ip++; VM_NEXT;
+        VM_CASE(IN)
+            if (!read_input(r[ip->a])) { ok = fault("no input available", ip - code); goto done; }
+            ip++;
+            VM_NEXT;
+        VM_CASE(LIMM) r[ip->a] = ip->imm; ip++; VM_NEXT;
+        VM_CASE(ADD) r[ip->a] = (uint32_t)r[ip->b] + (uint32_t)r[ip->c]; ip++; VM_NEXT;
+        VM_CASE(SUB) r[ip->a] = (uint32_t)r[ip->b] - (uint32_t)r[ip->c]; ip++; VM_NEXT;
+        VM_CASE(MULT) r[ip->a] = (uint32_t)r[ip->b] * (uint32_t)r[ip->c]; ip++; VM_NEXT;
+        VM_CASE(DIV)
+            if (r[ip->c] == 0) { ok = fault("division by zero", ip - code); goto done; }
+            r[ip->a] = sad_div(r[ip->b], r[ip->c]);
+            ip++;
+            VM_NEXT;
+        VM_CASE(ADDI) r[ip->a] = (uint32_t)r[ip->a] + (uint32_t)ip->imm; ip++; VM_NEXT;
+        VM_CASE(SUBI) r[ip->a] = (uint32_t)r[ip->a] - (uint32_t)ip->imm; ip++; VM_NEXT;
+        VM_CASE(MULTI) r[ip->a] = (uint32_t)r[ip->a] * (uint32_t)ip->imm; ip++; VM_NEXT;
+        VM_CASE(DIVI)
+            if (ip->imm == 0) { ok = fault("division by zero", ip - code); goto done; }
+            r[ip->a] = sad_div(r[ip->a], ip->imm);
+            ip++;
+            VM_NEXT;
+        VM_CASE(EQ) cond = r[ip->a] == r[ip->b]; ip++; VM_NEXT;
+        VM_CASE(NEQ) cond = r[ip->a] != r[ip->b]; ip++; VM_NEXT;
+        VM_CASE(LT) cond = r[ip->a] < r[ip->b]; ip++; VM_NEXT;
+        VM_CASE(GT) cond = r[ip->a] > r[ip->b]; ip++; VM_NEXT;
+        VM_CASE(LTE) cond = r[ip->a] <= r[ip->b]; ip++; VM_NEXT;
+        VM_CASE(GTE) cond = r[ip->a] >= r[ip->b]; ip++; VM_NEXT;
+        VM_CASE(CNT) r[REG_CNT] = ip->imm; ip++; VM_NEXT;
+        VM_CASE(LOOP)
+            r[REG_CNT] = (uint32_t)r[REG_CNT] - 1;
+            if (profiling && r[REG_CNT]) taken[ip - code]++;
+            ip = r[REG_CNT] ? code + ip->imm : ip + 1;
+            VM_NEXT;
+        VM_CASE(JMP) ip = code + ip->imm; VM_NEXT;
+        VM_CASE(JMPC)
+            if (profiling && !cond) taken[ip - code]++;
+            ip = cond ? ip + 1 : code + ip->imm;
+            VM_NEXT;
+        VM_CASE(JMPR) ra = ip - code + 1; ip = code + ip->imm; VM_NEXT;
+        VM_CASE(RET) ip = code + ((uint32_t)ra < size ? ra : size); VM_NEXT;
+        VM_CASE(INC) r[ip->a] = (uint32_t)r[ip->a] + 1; ip++; VM_NEXT;
+        VM_CASE(DEC) r[ip->a] = (uint32_t)r[ip->a] - 1; ip++; VM_NEXT;
+        VM_CASE(PUSH)
+            if (stack_top == stack.size()) { ok = fault("push onto full stack", ip - code); goto done; }
+            stack[stack_top++] = r[ip->a];
+            ip++;
+            VM_NEXT;
+        VM_CASE(POP)
+            if (stack_top == 0) { ok = fault("pop from empty stack", ip - code); goto done; }
+            r[ip->a] = stack[--stack_top];
+            ip++;
+            VM_NEXT;
+        VM_CASE(SLOW) {
+            uint32_t pc = ip - code;
+            r[REG_PC] = pc + 1;
+            if (!step(program[pc], pc)) { ok = false; goto done; }
+            ip = code + ((uint32_t)r[REG_PC] < size ? (uint32_t)r[REG_PC] : size);
+            VM_NEXT;
+        }
+        VM_CASE(BAD)
+            ok = unsupported(ip - code);
+            goto done;
+        VM_CASE(HALT)
+            goto done;
+
+        // superinstructions, which profiling runs never dispatch to, a fault in the second
+        // instruction counts the first as executed and stops at the second
+        VM_CASE(EQ_JMPC) cond = r[ip->a] == r[ip->b]; ip = cond ? ip + 2 : code + ip[1].imm; VM_NEXT_PAIR;
+        VM_CASE(NEQ_JMPC) cond = r[ip->a] != r[ip->b]; ip = cond ? ip + 2 : code + ip[1].imm; VM_NEXT_PAIR;
+        VM_CASE(LT_JMPC) cond = r[ip->a] < r[ip->b]; ip = cond ? ip + 2 : code + ip[1].imm; VM_NEXT_PAIR;
+        VM_CASE(GT_JMPC) cond = r[ip->a] > r[ip->b]; ip = cond ? ip + 2 : code + ip[1].imm; VM_NEXT_PAIR;
+        VM_CASE(LTE_JMPC) cond = r[ip->a] <= r[ip->b]; ip = cond ? ip + 2 : code + ip[1].imm; VM_NEXT_PAIR;
+        VM_CASE(GTE_JMPC) cond = r[ip->a] >= r[ip->b]; ip = cond ? ip + 2 : code + ip[1].imm; VM_NEXT_PAIR;
+        VM_CASE(LIMM_LOAD)
+            r[ip->a] = ip->imm;
+            ip++;
+            if ((uint32_t)r[ip->b] >= memory_size) { count++; ok = fault("data memory address out of range", ip - code); goto done; }
+            r[ip->a] = memory[r[ip->b]];
+            ip++;
+            VM_NEXT_PAIR;
+        VM_CASE(LIMM_STOR)
+            r[ip->a] = ip->imm;
+            ip++;
+            if ((uint32_t)r[ip->a] >= memory_size) { count++; ok = fault("data memory address out of range", ip - code); goto done; }
+            memory[r[ip->a]] = r[ip->b];
+            ip++;
+            VM_NEXT_PAIR;
+        VM_CASE(ADD_MOV) r[ip->a] = (uint32_t)r[ip->b] + (uint32_t)r[ip->c]; r[ip[1].a] = r[ip[1].b]; ip += 2; VM_NEXT_PAIR;
+        VM_CASE(SUB_MOV) r[ip->a] = (uint32_t)r[ip->b] - (uint32_t)r[ip->c]; r[ip[1].a] = r[ip[1].b]; ip += 2; VM_NEXT_PAIR;
+        VM_CASE(MULT_MOV) r[ip->a] = (uint32_t)r[ip->b] * (uint32_t)r[ip->c]; r[ip[1].a] = r[ip[1].b]; ip += 2; VM_NEXT_PAIR;
+        VM_CASE(LIMM_ADD) r[ip->a] = ip->imm; r[ip[1].a] = (uint32_t)r[ip[1].b] + (uint32_t)r[ip[1].c]; ip += 2; VM_NEXT_PAIR;
+        VM_CASE(LIMM_SUB) r[ip->a] = ip->imm; r[ip[1].a] = (uint32_t)r[ip[1].b] - (uint32_t)r[ip[1].c]; ip += 2; VM_NEXT_PAIR;
+        VM_CASE(LIMM_MULT) r[ip->a] = ip->imm; r[ip[1].a] = (uint32_t)r[ip[1].b] * (uint32_t)r[ip[1].c]; ip += 2; VM_NEXT_PAIR;
+#ifndef SAD_VM_THREADED
+    }
+#endif
+
+    done:
+    executed = count;
+    r[REG_PC] = ip - code;
+    out.flush();
+    return ok;
+}
+
+bool sad_vm::run() {
+    if (use_jit && translate()) return run_jit();
+    return execute<false>(NULL, NULL);
+}
+
+bool sad_vm::run(sad_profile& profile) {
+    // one more entry for the trailing HALT
+    profile.hits.assign(program.size() + 1, 0);
+    profile.taken.assign(program.size() + 1, 0);
+    return execute<true>(profile.hits.data(), profile.taken.data());
+}
+
+// name of what an instruction does, splitting op codes by mode since an ADD and a DIV, or a load
+// and an output, cost very different amounts
+static std::string profile_op_name(uint32_t w) {
+    switch (sad_op(w)) {
+        case OP_MEM: {
+            int port = (w >> 17) & 3;
+            if (port == PORT_IO_OUT) return "MEM OUT";
+            if (port == PORT_IO_CHAR) return "MEM CHAR";
+            if (port == PORT_IO_IN) return "MEM IN";
+            return (w >> 19) & 1 ? "MEM STOR" : "MEM LOAD";
+        }
+        case OP_MATH: return std::string("MATH ") + math_names[w & 3];
+        case OP_MATHI: return std::string("MATHI ") + math_names[(w >> 22) & 3];
+        case OP_COMP: return std::string("COMP ") + comp_names[w & 7];
+        case OP_STCK: return (w & 1) == STCK_PUSH ? "STCK PUSH" : "STCK POP";
+        default: return op_names[sad_op(w)];
+    }
+}
+
+static double percent(uint64_t part, uint64_t total) { return total ? 100.0 * part / total : 0; }
+
+template <typename T> static bool by_count(const std::pair<uint64_t, T>& x, const std::pair<uint64_t, T>& y) {
+    return x.first != y.first ? x.first > y.first : x.second < y.second;
+}
+
+void sad_write_profile(FILE* file, const std::vector<uint32_t>& code, const std::vector<int32_t>& lines,
+                       const sad_profile& profile, size_t hot) {
+    uint64_t total = 0;
+    std::map<std::string, uint64_t> ops;
+    std::map<int32_t, uint64_t> line_hits;
+    std::vector<std::pair<uint64_t, uint32_t> > pcs;
+    for (uint32_t pc = 0; pc < code.size() && pc < profile.hits.size(); pc++) {
+        uint64_t hits = profile.hits[pc];
+        if (!hits) continue;
+        total += hits;
+        ops[profile_op_name(code[pc])] += hits;
+        if (pc < lines.size()) line_hits[lines[pc]] += hits;
+        pcs.push_back(std::make_pair(hits, pc));
+    }
+    fprintf(file, "Profile of %zu instructions, %llu executed\n", code.size(), (unsigned long long)total);
+
+    std::vector<std::pair<uint64_t, std::string> > op_order;
+    for (std::map<std::string, uint64_t>::iterator op = ops.begin(); op != ops.end(); op++) {
+        op_order.push_back(std::make_pair(op->second, op->first));
+    }
+    std::sort(op_order.begin(), op_order.end(), by_count<std::string>);
+    fprintf(file, "\nExecutions by op code:\n%14s %7s  %s\n", "count", "%", "op");
+    for (size_t i = 0; i < op_order.size(); i++) {
+        fprintf(file, "%14llu %6.2f%%  %s\n", (unsigned long long)op_order[i].first,
+            percent(op_order[i].first, total), op_order[i].second.c_str());
+    }
+
+    // branches show how often they jumped, which says whether a loop or IF is worth reshaping
+    std::sort(pcs.begin(), pcs.end(), by_count<uint32_t>);
+    fprintf(file, "\nHottest instructions:\n%8s %14s %7s %6s  %-28s %s\n", "pc", "count", "%", "line", "instruction", "branch");
+    for (size_t i = 0; i < pcs.size() && i < hot; i++) {
+        uint32_t pc = pcs[i].second;
+        char line[16] = "-";
+        if (pc < lines.size() && lines[pc]) snprintf(line, sizeof(line), "%d", lines[pc]);
+        std::string text = sad_disassemble(code[pc]);
+        if (sad_op(code[pc]) == OP_JMPC || sad_op(code[pc]) == OP_LOOP) {
+            text.resize(std::max<size_t>(text.size(), 28), ' ');
+            text += " taken " + std::to_string(profile.taken[pc]) + ", not taken " + std::to_string(pcs[i].first - profile.taken[pc]);
+        }
+        fprintf(file, "%8u %14llu %6.2f%% %6s  %s\n", pc, (unsigned long long)pcs[i].first,
+            percent(pcs[i].first, total), line, text.c_str());
+    }
+
+    if (line_hits.empty()) return;
+    std::vector<std::pair<uint64_t, int32_t> > line_order;
+    for (std::map<int32_t, uint64_t>::iterator l = line_hits.begin(); l != line_hits.end(); l++) {
+        line_order.push_back(std::make_pair(l->second, l->first));
+    }
+    std::sort(line_order.begin(), line_order.end(), by_count<int32_t>);
+    fprintf(file, "\nExecutions by source line:\n%6s %14s %7s\n", "line", "count", "%");
+    for (size_t i = 0; i < line_order.size(); i++) {
+        // line 0 is code belonging to no statement, the final halt
+        if (line_order[i].second) fprintf(file, "%6d", line_order[i].second);
+        else fprintf(file, "%6s", "-");
+        fprintf(file, " %14llu %6.2f%%\n", (unsigned long long)line_order[i].first, percent(line_order[i].first, total));
+    }
+}
@@ -0,0 +1,300 @@
+/*
+SAD_VM.h
+Author: Kristopher J. Carroll
+Description:
+    Native C++ implementation of SAD VM, running the same instruction set as SAD_VM.py from a packed
+    32-bit fixed-width encoding. The opcodes, math/comparison/memory/stack modes and register numbers
+    match the constants defined at the top of SAD_VM.py so that programs behave identically on both
+    machines.
+
+    Every instruction is exactly one 32-bit word with the opcode in the top four bits. The remaining
+    bits are laid out per instruction format:
+
+        MOV   dst[27:24] src[23:20]
+        MEM   a[27:24] b[23:20] mode[19] port[18:17]      (a = destination, b = source)
+        LIMM  dst[27:24] imm[23:0]                         (signed)
+        MATH  dst[27:24] src1[23:20] src2[19:16] mode[1:0]
+        MATHI dst[27:24] mode[23:22] imm[21:0]             (signed)
+        COMP  a[27:24] b[23:20] mode[2:0]
+        CNT   imm[27:0]
+        LOOP, JMP, JMPC, JMPR  target[27:0]                (all ones is the "None" halt target)
+        RET   -
+        INC, DEC  reg[27:24]
+        STCK  reg[27:24] mode[0]
+
+    The I/O ports of SAD_VM.py (0xffff0000 for integers, 0xffff0001 for characters and 0xff00 for
+    input) cannot be held in a four bit register field, so MEM carries a port selector that replaces
+    the operand referring to the port.
+
+    Writes to the output ports collect in a large buffer (see output.h) instead of going through a
+    stdio call each, so programs printing a value per iteration are not bound by the cost of writing.
+
+    Registers are 32 bits wide and arithmetic wraps on overflow. Division rounds towards negative
+    infinity to match Python's // operator used by SAD_VM.py.
+*/
+
+#ifndef SAD_VM_H
+#define SAD_VM_H
+
+#include <stdint.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "output.h"
+
+// op codes (SAD_VM.py names prefixed to avoid clashing with parser tokens)
+enum sad_opcode {
+    OP_MOV = 0x0, OP_MEM = 0x1, OP_LIMM = 0x2, OP_MATH = 0x3,
+    OP_MATHI = 0x4, OP_COMP = 0x5, OP_LOG = 0x6, OP_CNT = 0x7,
+    OP_LOOP = 0x8, OP_JMP = 0x9, OP_JMPC = 0xa, OP_JMPR = 0xb,
+    OP_RET = 0xc, OP_INC = 0xd, OP_DEC = 0xe, OP_STCK = 0xf
+};
+
+// math ops
+enum sad_math_mode { MATH_ADD = 0x0, MATH_SUB = 0x1, MATH_MULT = 0x2, MATH_DIV = 0x3 };
+
+// mem ops
+enum sad_mem_mode { MEM_LOAD = 0x0, MEM_STOR = 0x1 };
+
+// stack ops
+enum sad_stack_mode { STCK_PUSH = 0x0, STCK_POP = 0x1 };
+
+// comparative ops
+enum sad_comp_mode { COMP_EQ = 0x0, COMP_NEQ = 0x1, COMP_LT = 0x2, COMP_GT = 0x3, COMP_LTE = 0x4, COMP_GTE = 0x5 };
+
+// port selector for MEM instructions
+enum sad_port { PORT_NONE = 0x0, PORT_IO_OUT = 0x1, PORT_IO_CHAR = 0x2, PORT_IO_IN = 0x3 };
+
+// accessible registers
+enum sad_register {
+    REG_PC = 0x0, REG_CNT = 0x1,
+    REG_R0 = 0x2, REG_R1 = 0x3, REG_R2 = 0x4, REG_R3 = 0x5, REG_R4 = 0x6, REG_R5 = 0x7, REG_R6 = 0x8,
+    REG_R7 = 0x9, REG_R8 = 0xa, REG_R9 = 0xb, REG_R10 = 0xc, REG_R11 = 0xd, REG_R12 = 0xe, REG_R13 = 0xf
+};
+
+// port addresses as written in SAD_VM.py programs
+const uint32_t SAD_IO_OUT = 0xffff0000;
+const uint32_t SAD_IO_CHAR = 0xffff0001;
+const uint32_t SAD_IO_IN = 0xff00;
+
+// jump target used for (JMP, None), which halts the machine
+const uint32_t SAD_HALT = 0x0fffffff;
+
+const int32_t SAD_LIMM_MIN = -(1 << 23);
+const int32_t SAD_LIMM_MAX = (1 << 23) - 1;
+const int32_t SAD_MATHI_MIN = -(1 << 21);
+const int32_t SAD_MATHI_MAX = (1 << 21) - 1;
+
+// helpers for packing instruction words
+inline uint32_t sad_field(uint32_t value, int shift, int bits) { return (value & ((1u << bits) - 1)) << shift; }
+inline int32_t sad_signed(uint32_t word, int bits) { return (int32_t)(word << (32 - bits)) >> (32 - bits); }
+
+inline uint32_t sad_mov(int dst, int src) { return sad_field(OP_MOV, 28, 4) | sad_field(dst, 24, 4) | sad_field(src, 20, 4); }
+inline uint32_t sad_mem(int a, int b, int mode, int port) {
+    return sad_field(OP_MEM, 28, 4) | sad_field(a, 24, 4) | sad_field(b, 20, 4) | sad_field(mode, 19, 1) | sad_field(port, 17, 2);
+}
+inline uint32_t sad_limm(int dst, int32_t imm) { return sad_field(OP_LIMM, 28, 4) | sad_field(dst, 24, 4) | sad_field(imm, 0, 24); }
+inline uint32_t sad_math(int dst, int src1, int src2, int mode) {
+    return sad_field(OP_MATH, 28, 4) | sad_field(dst, 24, 4) | sad_field(src1, 20, 4) | sad_field(src2, 16, 4) | sad_field(mode, 0, 2);
+}
+inline uint32_t sad_mathi(int dst, int mode, int32_t imm) {
+    return sad_field(OP_MATHI, 28, 4) | sad_field(dst, 24, 4) | sad_field(mode, 22, 2) | sad_field(imm, 0, 22);
+}
+inline uint32_t sad_comp(int a, int b, int mode) { return sad_field(OP_COMP, 28, 4) | sad_field(a, 24, 4) | sad_field(b, 20, 4) | sad_field(mode, 0, 3); }
+inline uint32_t sad_target(int op, uint32_t target) { return sad_field(op, 28, 4) | sad_field(target, 0, 28); }
+inline uint32_t sad_reg(int op, int reg) { return sad_field(op, 28, 4) | sad_field(reg, 24, 4); }
+inline uint32_t sad_stck(int reg, int mode) { return sad_field(OP_STCK, 28, 4) | sad_field(reg, 24, 4) | sad_field(mode, 0, 1); }
+
+// field accessors used by the decoder
+inline int sad_op(uint32_t w) { return w >> 28; }
+inline int sad_a(uint32_t w) { return (w >> 24) & 0xf; }
+inline int sad_b(uint32_t w) { return (w >> 20) & 0xf; }
+inline int sad_c(uint32_t w) { return (w >> 16) & 0xf; }
+
+// floor division matching Python's //, callers guarantee b != 0
+inline int32_t sad_div(int32_t a, int32_t b) {
+    if (b == -1) return (int32_t)(0u - (uint32_t)a);
+    int32_t q = a / b;
+    if ((a % b != 0) && ((a < 0) != (b < 0))) q--;
+    return q;
+}
+
+// assembles the "(OP, arg, ...)" tuple text printed by program::compile() (and used in SAD_VM.py)
+// into packed instruction words, text outside of the parentheses and # comments are ignored
+bool sad_assemble(const std::string& text, std::vector<uint32_t>& words, std::string& error);
+
+// produces the tuple text for a single packed instruction word
+std::string sad_disassemble(uint32_t word);
+
+// Object file produced by "pascal -o file.sadbin" and loaded by both machines without any parsing.
+// Every field is a 32-bit little-endian word:
+//
+//     magic "SADB", version, code words, data base address, data words
+//     packed instruction words
+//     initial data memory contents, stored from the data base address upwards
+//
+// The data section holds the memory cells the compiled program uses (program variables and spilled
+// temporaries, see regalloc.h), cleared to zero so SAD_VM.py, whose memory is a plain dict, can
+// load them before they are ever stored to.
+const uint32_t SAD_IMAGE_MAGIC = 0x42444153; // "SADB" read as a little-endian word
+const uint32_t SAD_IMAGE_VERSION = 1;
+const size_t SAD_IMAGE_HEADER_WORDS = 5;
+
+struct sad_image {
+    std::vector<uint32_t> code;
+    uint32_t data_base;
+    std::vector<int32_t> data;
+    std::vector<int32_t> lines; // source line of each instruction for profiling, not kept in object files
+
+    sad_image() : data_base(0) { }
+};
+
+// writes image to path, returning false and setting error if the file could not be written
+bool sad_write_image(const std::string& path, const sad_image& image, std::string& error);
+
+// maps the object file at path and unpacks it into image, returning false and setting error if it
+// could not be read or is not a valid object file, including one whose data section ends past
+// SAD_MEMORY_WORDS
+bool sad_read_image(const std::string& path, sad_image& image, std::string& error);
+
+// execution counts gathered by sad_vm::run(sad_profile&), indexed by instruction address
+struct sad_profile {
+    std::vector<uint64_t> hits; // times each instruction was executed
+    std::vector<uint64_t> taken; // times each LOOP or JMPC went to its target instead of falling through
+};
+
+// writes a hot spot report for a profiled run of code to file: executions per op code, the hot most
+// executed instructions and executions per source line, lines being the program's line table (or
+// empty when there is none, for programs that were not compiled in this process)
+void sad_write_profile(FILE* file, const std::vector<uint32_t>& code, const std::vector<int32_t>& lines,
+                       const sad_profile& profile, size_t hot);
+
+// Instructions are pre-decoded once at load time into one handler per op code and mode, so the
+// execution loop never re-parses instruction words. Instructions using PC as a register operand
+// go through the SLOW handler, which executes the original word with regs[PC] kept up to date.
+// Running off the end of the program or jumping to None lands on a trailing HALT handler.
+//
+// The last group are superinstructions, each executing an instruction together with the one after
+// it in a single dispatch. They cover the pairs that profiles of the compiler's output show running
+// most: a comparison and its JMPC, a constant address loaded for a LOAD or STOR, arithmetic whose
+// result is moved into a variable's register and arithmetic on a constant just loaded.
+#define SAD_HANDLERS(X) \
+    X(MOV) X(LOAD) X(STOR) X(OUT) X(CHAR) X(IN) X(LIMM) \
+    X(ADD) X(SUB) X(MULT) X(DIV) X(ADDI) X(SUBI) X(MULTI) X(DIVI) \
+    X(EQ) X(NEQ) X(LT) X(GT) X(LTE) X(GTE) \
+    X(CNT) X(LOOP) X(JMP) X(JMPC) X(JMPR) X(RET) X(INC) X(DEC) \
+    X(PUSH) X(POP) X(SLOW) X(BAD) X(HALT) \
+    X(EQ_JMPC) X(NEQ_JMPC) X(LT_JMPC) X(GT_JMPC) X(LTE_JMPC) X(GTE_JMPC) \
+    X(LIMM_LOAD) X(LIMM_STOR) X(ADD_MOV) X(SUB_MOV) X(MULT_MOV) X(LIMM_ADD) X(LIMM_SUB) X(LIMM_MULT)
+
+#define SAD_HANDLER_ENUM(name) H_##name,
+enum sad_handler { SAD_HANDLERS(SAD_HANDLER_ENUM) H_COUNT };
+#undef SAD_HANDLER_ENUM
+
+// pre-decoded instruction, label is the handler address when using threaded dispatch
+//
+// handler is what the instruction does on its own, dispatch is the handler ordinary runs execute,
+// which is a superinstruction when the instruction starts one. The instruction after it keeps its
+// own handler, so jumping straight to it still works. Profiling runs count every instruction and
+// dispatch on handler.
+struct sad_decoded {
+    const void* label;
+    uint8_t handler;
+    uint8_t dispatch;
+    uint8_t a, b, c; // register operands
+    int32_t imm; // immediate value or jump target
+};
+
+// pre-decodes program into decoded, with the trailing HALT, leaving the labels unbound
+void sad_decode(const std::vector<uint32_t>& program, std::vector<sad_decoded>& decoded);
+
+// default data memory and stack sizes in words, matching MEMORY_SIZE and STACK_SIZE in SAD_VM.py
+const size_t SAD_MEMORY_WORDS = 1 << 20;
+const size_t SAD_STACK_WORDS = 1 << 16;
+
+class sad_jit;
+
+// the machine itself, holding the same state as the Machine class of SAD_VM.py
+//
+// Data memory and the stack are flat arrays allocated once when the machine is created, so memory
+// accesses are plain indexing. Addresses outside of data memory, pushing onto a full stack and
+// popping from an empty one stop the machine with a fault.
+//
+// The dispatch loop is direct-threaded (computed goto) when built with GCC or Clang, and falls
+// back to a portable switch when SAD_VM_SWITCH_DISPATCH is defined or computed goto is unavailable.
+// Profiling runs use a second copy of the loop with the counting compiled in, so ordinary runs do
+// not pay for it. With JIT turned on, run() executes the program translated to native code instead
+// (see jit.h), profiling runs always use the interpreter.
+class sad_vm {
+    protected:
+        std::vector<uint32_t> program; // packed program instructions
+        std::vector<sad_decoded> decoded; // pre-decoded program with trailing HALT
+        const void* const* bound; // handler address table decoded labels point into, NULL until bound
+        std::vector<int32_t> mem; // data memory, addressed from 0
+        std::vector<int32_t> stack; // fixed capacity stack, stack_top values in use
+        size_t stack_top;
+        output_buffer out; // output ports, flushed when full, before reading input and on halt
+        const int32_t* input; // values for the input port, read from stdin when NULL
+        size_t input_size, input_next;
+        std::string error_msg;
+        bool use_jit; // whether run() executes native code translated from the program
+        sad_jit* jit; // translation of the program, NULL until it first runs with JIT on
+        bool fault(const std::string& msg, uint32_t pc);
+        bool unsupported(uint32_t pc);
+        bool read_input(int32_t& value);
+        void decode();
+        bool step(uint32_t word, uint32_t pc);
+        // the execution loop, built once as it is and once counting into hits and taken
+        template <bool profiling> bool execute(uint64_t* hits, uint64_t* taken);
+        // translates the program if it has not been already, returning false if it cannot be
+        bool translate();
+        bool run_jit();
+        void discard_jit();
+    public:
+        int32_t regs[16]; // registers: 0 is PC, 1 is CNT
+        int32_t cond; // conditional register
+        int32_t ra; // return address register
+        uint64_t executed; // number of instructions executed by the last run
+
+        sad_vm(size_t memory_words = SAD_MEMORY_WORDS, size_t stack_words = SAD_STACK_WORDS) :
+            bound(NULL), mem(memory_words), stack(stack_words), input(NULL), input_size(0), input_next(0),
+            use_jit(false), jit(NULL) { reset(); }
+        ~sad_vm();
+        // machines own their translated code, so they are never copied
+        sad_vm(const sad_vm&) = delete;
+        sad_vm& operator=(const sad_vm&) = delete;
+        void load(const std::vector<uint32_t>& words) { program = words; discard_jit(); decode(); reset(); }
+        // loads an object file's code and fills data memory from its data section
+        void load(const sad_image& image) {
+            load(image.code);
+            load_data(image);
+        }
+        // fills data memory from an object file's data section, used again after reset() to start the
+        // same program over
+        void load_data(const sad_image& image) {
+            // data memory is grown to hold the whole data section if it does not fit already
+            if (image.data_base + image.data.size() > mem.size()) mem.resize(image.data_base + image.data.size());
+            std::copy(image.data.begin(), image.data.end(), mem.begin() + image.data_base);
+        }
+        void reset();
+        // runs until the machine halts, returning false if execution stopped on a fault
+        bool run();
+        // the same, counting every instruction executed and every branch taken into profile
+        bool run(sad_profile& profile);
+        const std::string& error() const { return error_msg; }
+        // runs programs translated to native code from now on, where this build supports it
+        void set_jit(bool on) { use_jit = on; }
+        // sends everything written to the output ports to file from now on
+        void set_output(FILE* file) { out.set_file(file); }
+        // appends everything written to the output ports to text from now on
+        void set_output(std::string* text) { out.set_string(text); }
+        // reads the input port from the count values from now on instead of from stdin, faulting once
+        // they run out, or from stdin again when values is NULL
+        void set_input(const int32_t* values, size_t count) {
+            input = values;
+            input_size = count;
+            input_next = 0;
+        }
+};
+
+#endif
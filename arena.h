@@ -0,0 +1,89 @@
+/*
+arena.h
+Author: Kristopher J. Carroll
+Description:
+    Bump allocator used for everything built while parsing a program: AST nodes, statement vectors
+    and identifier strings. Memory is handed out sequentially from large blocks and is never freed
+    individually. Instead the whole arena is released in one shot once compilation has finished,
+    so objects placed in it must not own memory outside of the arena (destructors are never run).
+    Blocks come from operator new, which throws when out of memory and is counted by the
+    allocation instrumentation of --time-passes (see instrument.h).
+*/
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <new>
+#include <vector>
+
+class arena {
+    protected:
+        std::vector<char*> blocks; // every block allocated so far, released together
+        char* next; // next free byte in the current block
+        size_t left; // bytes remaining in the current block
+        size_t block_size;
+    public:
+        arena(size_t block_size_ = 64 * 1024) : next(NULL), left(0), block_size(block_size_) { }
+        ~arena() { release(); }
+
+        void* allocate(size_t size, size_t align = alignof(max_align_t)) {
+            size_t pad = (align - ((size_t)next & (align - 1))) & (align - 1);
+            if (pad + size > left) {
+                // oversized requests get a block of their own so the current block is not wasted
+                size_t size_needed = size + align;
+                if (size_needed > block_size / 4) {
+                    char* block = (char*)::operator new(size_needed);
+                    blocks.push_back(block);
+                    return block + ((align - ((size_t)block & (align - 1))) & (align - 1));
+                }
+                next = (char*)::operator new(block_size);
+                blocks.push_back(next);
+                left = block_size;
+                pad = (align - ((size_t)next & (align - 1))) & (align - 1);
+            }
+            void* result = next + pad;
+            next += pad + size;
+            left -= pad + size;
+            return result;
+        }
+
+        // copies a string into the arena, returning the NUL terminated copy
+        char* copy_string(const char* str, size_t len) {
+            char* copy = (char*)allocate(len + 1, 1);
+            memcpy(copy, str, len);
+            copy[len] = '\0';
+            return copy;
+        }
+
+        // frees every allocation at once
+        void release() {
+            for (size_t i = 0; i < blocks.size(); i++) ::operator delete(blocks[i]);
+            blocks.clear();
+            next = NULL;
+            left = 0;
+        }
+};
+
+// placement form used as "new (some_arena) node(...)"
+inline void* operator new(size_t size, arena& a) { return a.allocate(size); }
+inline void operator delete(void*, arena&) { }
+
+// standard allocator adaptor so containers such as statement vectors can grow inside an arena,
+// memory left behind by reallocation is reclaimed along with the rest of the arena
+template <typename T>
+class arena_allocator {
+    public:
+        typedef T value_type;
+        arena* pool;
+        arena_allocator(arena& pool_) : pool(&pool_) { }
+        template <typename U> arena_allocator(const arena_allocator<U>& other) : pool(other.pool) { }
+        T* allocate(size_t n) { return (T*)pool->allocate(n * sizeof(T), alignof(T)); }
+        void deallocate(T*, size_t) { }
+        template <typename U> bool operator==(const arena_allocator<U>& other) const { return pool == other.pool; }
+        template <typename U> bool operator!=(const arena_allocator<U>& other) const { return pool != other.pool; }
+};
+
+#endif
@@ -0,0 +1,296 @@
+/*
+batch_vm.cpp
+Author: Kristopher J. Carroll
+Description:
+    Lockstep execution of program instances in SIMD lanes, see batch_vm.h.
+*/
+
+#include <algorithm>
+#include "batch_vm.h"
+
+// writes value into the lanes of dst being run, g going over the SIMD operations of the warp
+#define SAD_LANES(dst, value) \
+    for (size_t g = first; g < last; g++) (dst)[g] = ((value) & m[g]) | ((dst)[g] & ~m[g])
+
+static sad_lanes splat(uint32_t x) {
+    sad_lanes v = {};
+    return v + x;
+}
+
+static bool any(sad_lanes v) {
+    for (size_t i = 0; i < SAD_LANE_WIDTH; i++) if (v[i]) return true;
+    return false;
+}
+
+sad_batch_vm::sad_batch_vm(size_t lanes_, size_t memory_words_, size_t stack_words_) :
+    lanes(lanes_), padded((lanes_ + SAD_LANE_WIDTH - 1) / SAD_LANE_WIDTH * SAD_LANE_WIDTH),
+    groups(padded / SAD_LANE_WIDTH), memory_words(memory_words_), memory_size(0), memory_limit(0), stack_words(stack_words_),
+    regs(16 * groups), cond(groups), ra(groups), mask(groups), taken(groups),
+    // pushes write every word of the stack before it is read, so it is left uninitialized and only
+    // the depths lanes get to are ever touched
+    stack(new uint32_t[stack_words * padded]),
+    stack_top(lanes), pc(lanes), status(lanes), inputs(lanes), outputs(lanes), errors(lanes), counts(lanes),
+    warp_begin(0), warp_end(0), member_begin(0), member_end(0), running(0), group(0) {
+    lane_input none = { NULL, 0, 0 };
+    std::fill(inputs.begin(), inputs.end(), none);
+    load(sad_image());
+}
+
+void sad_batch_vm::load(const sad_image& image_) {
+    image = image_;
+    sad_decode(image.code, decoded);
+    memory_size = image.data_base + image.data.size();
+    memory_limit = memory_words ? memory_words : std::max(memory_size, SAD_BATCH_MEMORY_WORDS);
+    mem.assign(memory_size * padded, 0);
+    reset();
+}
+
+void sad_batch_vm::reset() {
+    std::fill(regs.begin(), regs.end(), splat(0));
+    std::fill(cond.begin(), cond.end(), splat(0));
+    std::fill(ra.begin(), ra.end(), splat(0));
+    std::fill(mem.begin(), mem.end(), 0);
+    for (size_t i = 0; i < image.data.size(); i++) {
+        std::fill_n(mem.begin() + (image.data_base + i) * padded, padded, image.data[i]);
+    }
+    std::fill(stack_top.begin(), stack_top.end(), 0);
+    std::fill(pc.begin(), pc.end(), 0);
+    std::fill(status.begin(), status.end(), RUNNING);
+    std::fill(counts.begin(), counts.end(), 0);
+    for (size_t l = 0; l < lanes; l++) {
+        inputs[l].next = 0;
+        outputs[l].clear();
+        errors[l].clear();
+    }
+}
+
+void sad_batch_vm::set_input(size_t lane, const int32_t* values, size_t count) {
+    lane_input input = { values, count, 0 };
+    inputs[lane] = input;
+}
+
+// stops a lane being run, taking it out of the group
+void sad_batch_vm::fault(size_t lane, const std::string& msg, uint32_t at, uint64_t steps) {
+    errors[lane] = msg + " at instruction " + std::to_string(at);
+    status[lane] = FAULTED;
+    counts[lane] += steps;
+    pc[lane] = at;
+    ((uint32_t*)mask.data())[lane] = 0;
+    running--;
+    group--;
+}
+
+// runs the lanes in mask from start, all at the same PC, until they halt, a branch splits them, or
+// they reach waiting, the lowest PC other lanes wait at
+void sad_batch_vm::run_group(uint32_t start, uint32_t waiting) {
+    const sad_decoded* code = decoded.data();
+    uint32_t size = decoded.size() - 1;
+    sad_lanes* m = mask.data();
+    // lanes from the first to the last being run, and the SIMD operations covering them
+    size_t low = member_begin, high = member_end;
+    size_t first = low / SAD_LANE_WIDTH, last = (high + SAD_LANE_WIDTH - 1) / SAD_LANE_WIDTH;
+    uint32_t p = start;
+    uint64_t steps = 0;
+    bool split = false; // lanes went different ways, with every lane's PC set
+    while (group && !split && p < waiting) {
+        const sad_decoded& d = code[p];
+        uint32_t next = p + 1;
+        switch (d.handler) {
+            case H_MOV: { sad_lanes* a = row(d.a); const sad_lanes* b = row(d.b); SAD_LANES(a, b[g]); break; }
+            case H_LIMM: { sad_lanes* a = row(d.a); sad_lanes v = splat(d.imm); SAD_LANES(a, v); break; }
+            case H_ADD: { sad_lanes* a = row(d.a); const sad_lanes* b = row(d.b); const sad_lanes* c = row(d.c); SAD_LANES(a, b[g] + c[g]); break; }
+            case H_SUB: { sad_lanes* a = row(d.a); const sad_lanes* b = row(d.b); const sad_lanes* c = row(d.c); SAD_LANES(a, b[g] - c[g]); break; }
+            case H_MULT: { sad_lanes* a = row(d.a); const sad_lanes* b = row(d.b); const sad_lanes* c = row(d.c); SAD_LANES(a, b[g] * c[g]); break; }
+            case H_ADDI: { sad_lanes* a = row(d.a); sad_lanes v = splat(d.imm); SAD_LANES(a, a[g] + v); break; }
+            case H_SUBI: { sad_lanes* a = row(d.a); sad_lanes v = splat(d.imm); SAD_LANES(a, a[g] - v); break; }
+            case H_MULTI: { sad_lanes* a = row(d.a); sad_lanes v = splat(d.imm); SAD_LANES(a, a[g] * v); break; }
+            case H_INC: { sad_lanes* a = row(d.a); sad_lanes one = splat(1); SAD_LANES(a, a[g] + one); break; }
+            case H_DEC: { sad_lanes* a = row(d.a); sad_lanes one = splat(1); SAD_LANES(a, a[g] - one); break; }
+            case H_CNT: { sad_lanes* n = row(REG_CNT); sad_lanes v = splat(d.imm); SAD_LANES(n, v); break; }
+
+            // comparisons leave all ones in cond where they hold
+            #define SAD_COMPARE(handler, op) \
+            case handler: { \
+                const sad_signed_lanes* a = (const sad_signed_lanes*)row(d.a); \
+                const sad_signed_lanes* b = (const sad_signed_lanes*)row(d.b); \
+                sad_lanes* c = cond.data(); \
+                SAD_LANES(c, (sad_lanes)(a[g] op b[g])); \
+                break; \
+            }
+            SAD_COMPARE(H_EQ, ==)
+            SAD_COMPARE(H_NEQ, !=)
+            SAD_COMPARE(H_LT, <)
+            SAD_COMPARE(H_GT, >)
+            SAD_COMPARE(H_LTE, <=)
+            SAD_COMPARE(H_GTE, >=)
+            #undef SAD_COMPARE
+
+            // division can fault, so it goes lane by lane
+            case H_DIV:
+            case H_DIVI: {
+                uint32_t* a = lane_row(d.a);
+                const uint32_t* b = lane_row(d.handler == H_DIV ? d.b : d.a);
+                const uint32_t* c = lane_row(d.c);
+                for (size_t l = low; l < high; l++) {
+                    if (!member(l)) continue;
+                    int32_t divisor = d.handler == H_DIV ? c[l] : d.imm;
+                    if (divisor == 0) fault(l, "division by zero", p, steps);
+                    else a[l] = sad_div(b[l], divisor);
+                }
+                break;
+            }
+            case H_LOAD:
+            case H_STOR: {
+                uint32_t* a = lane_row(d.a);
+                uint32_t* b = lane_row(d.b);
+                for (size_t l = low; l < high; l++) {
+                    if (!member(l)) continue;
+                    uint32_t address = d.handler == H_LOAD ? b[l] : a[l];
+                    // rows past the data section are added as lanes first get to them
+                    if (address >= memory_size && address < memory_limit) {
+                        memory_size = address + 1;
+                        mem.resize(memory_size * padded, 0);
+                    }
+                    if (address >= memory_size) fault(l, "data memory address out of range", p, steps);
+                    else if (d.handler == H_LOAD) a[l] = mem[address * padded + l];
+                    else mem[address * padded + l] = b[l];
+                }
+                break;
+            }
+            case H_OUT:
+            case H_CHAR: {
+                const uint32_t* b = lane_row(d.b);
+                for (size_t l = low; l < high; l++) {
+                    if (!member(l)) continue;
+                    if (d.handler == H_OUT) outputs[l] += std::to_string((int32_t)b[l]) + '\n';
+                    else outputs[l] += b[l] == 0 ? '\n' : (char)b[l];
+                }
+                break;
+            }
+            case H_IN: {
+                uint32_t* a = lane_row(d.a);
+                for (size_t l = low; l < high; l++) {
+                    if (!member(l)) continue;
+                    lane_input& input = inputs[l];
+                    if (input.next == input.size) fault(l, "no input available", p, steps);
+                    else a[l] = input.values[input.next++];
+                }
+                break;
+            }
+            case H_PUSH:
+            case H_POP: {
+                uint32_t* a = lane_row(d.a);
+                for (size_t l = low; l < high; l++) {
+                    if (!member(l)) continue;
+                    if (d.handler == H_PUSH && stack_top[l] == stack_words) fault(l, "push onto full stack", p, steps);
+                    else if (d.handler == H_POP && stack_top[l] == 0) fault(l, "pop from empty stack", p, steps);
+                    else if (d.handler == H_PUSH) stack[stack_top[l]++ * padded + l] = a[l];
+                    else a[l] = stack[--stack_top[l] * padded + l];
+                }
+                break;
+            }
+
+            // a branch the lanes agree on keeps them together, otherwise each lane goes its own way
+            case H_JMPC:
+            case H_LOOP: {
+                if (d.handler == H_LOOP) {
+                    sad_lanes* n = row(REG_CNT);
+                    sad_lanes one = splat(1);
+                    SAD_LANES(n, n[g] - one);
+                    for (size_t g = first; g < last; g++) taken[g] = m[g] & (sad_lanes)(n[g] != splat(0));
+                }
+                else {
+                    for (size_t g = first; g < last; g++) taken[g] = m[g] & ~cond[g];
+                }
+                sad_lanes go = {}, stay = {};
+                for (size_t g = first; g < last; g++) {
+                    go |= taken[g];
+                    stay |= m[g] & ~taken[g];
+                }
+                if (!any(go)) break;
+                next = d.imm;
+                split = any(stay);
+                for (size_t l = low; l < high && split; l++) {
+                    if (member(l)) pc[l] = ((const uint32_t*)taken.data())[l] ? d.imm : p + 1;
+                }
+                break;
+            }
+            case H_JMP:
+                next = d.imm;
+                break;
+            case H_JMPR: {
+                sad_lanes* r = ra.data();
+                sad_lanes back = splat(p + 1);
+                SAD_LANES(r, back);
+                next = d.imm;
+                break;
+            }
+            case H_RET: {
+                const uint32_t* r = (const uint32_t*)ra.data();
+                bool first = true;
+                for (size_t l = low; l < high; l++) {
+                    if (!member(l)) continue;
+                    pc[l] = r[l] < size ? r[l] : size;
+                    if (first) next = pc[l];
+                    else if (pc[l] != next) split = true;
+                    first = false;
+                }
+                break;
+            }
+
+            case H_HALT:
+                for (size_t l = low; l < high; l++) {
+                    if (!member(l)) continue;
+                    status[l] = HALTED;
+                    counts[l] += steps;
+                    pc[l] = p;
+                }
+                running -= group;
+                group = 0;
+                return;
+            case H_SLOW:
+            default:
+                for (size_t l = low; l < high; l++) {
+                    if (member(l)) fault(l, d.handler == H_SLOW ? "PC as a register operand is not supported in batch runs" :
+                                            "unsupported instruction", p, steps);
+                }
+                break;
+        }
+        steps++;
+        p = next;
+    }
+    for (size_t l = low; l < high; l++) {
+        if (!member(l)) continue;
+        counts[l] += steps;
+        if (!split) pc[l] = p;
+    }
+}
+
+bool sad_batch_vm::run() {
+    uint32_t* m = (uint32_t*)mask.data();
+    for (warp_begin = 0; warp_begin < lanes; warp_begin = warp_end) {
+        warp_end = std::min(lanes, warp_begin + SAD_WARP_LANES);
+        running = 0;
+        for (size_t l = warp_begin; l < warp_end; l++) if (status[l] == RUNNING) running++;
+        while (running) {
+            // the lanes at the lowest PC run next, up to the next lowest PC any lane waits at
+            uint32_t at = UINT32_MAX, waiting = UINT32_MAX;
+            for (size_t l = warp_begin; l < warp_end; l++) {
+                if (status[l] != RUNNING) continue;
+                if (pc[l] < at) waiting = at, at = pc[l];
+                else if (pc[l] > at && pc[l] < waiting) waiting = pc[l];
+            }
+            group = 0;
+            member_begin = warp_end;
+            for (size_t l = warp_begin; l < warp_begin + SAD_WARP_LANES && l < padded; l++) {
+                m[l] = l < warp_end && status[l] == RUNNING && pc[l] == at ? ~0u : 0;
+                if (!m[l]) continue;
+                if (!group++) member_begin = l;
+                member_end = l + 1;
+            }
+            run_group(at, waiting);
+        }
+    }
+    for (size_t l = 0; l < lanes; l++) if (status[l] == FAULTED) return false;
+    return true;
+}
@@ -0,0 +1,117 @@
+/*
+batch_vm.h
+Author: Kristopher J. Carroll
+Description:
+    Lockstep execution of many instances of one SAD VM program, each with inputs of its own, for
+    sweeps running the same program over thousands of different inputs (pascal --batch). Every
+    instance is a lane of one machine: each SAD register is a row holding its value in every lane,
+    and data memory and the stack are laid out the same way, one row of lanes per address.
+
+    Instructions are dispatched once for all the lanes they run on. MOV, LIMM, MATH, MATHI, COMP and
+    the counter run as SIMD operations over SAD_LANE_WIDTH lanes at a time using GCC vector types,
+    blending the results into the lanes being run with a mask. Division, memory, the I/O ports and
+    the stack go lane by lane.
+
+    Lanes stay together as long as their branches agree. When a branch splits them, each lane
+    carries on from its own PC and the lanes at the lowest PC run next, so lanes skipping code wait
+    where they are until the others have run it and catch up. In structured code that brings them
+    back together after an IF and once every lane has left a loop. A lane that faults stops with an
+    error of its own while the others carry on. Lanes are run SAD_WARP_LANES at a time, each warp
+    to the end before the next starts, so a few lanes looping far longer than the rest only keep
+    their own warp waiting. Sweeps whose lanes mostly agree on their branches gain the most, as
+    lanes splitting at every branch run slower than they would one at a time.
+
+    Data memory and the stack are allocated for every lane, so they only take up what the program
+    uses. Data memory starts out holding the program's data section, all compiled programs ever
+    address, and grows as lanes address more of it up to its size, by default SAD_BATCH_MEMORY_WORDS
+    for programs assembled from text, which carry no data section. The stack is only touched as
+    deep as lanes push, SAD_BATCH_STACK_WORDS at most by default. Instructions using PC as an
+    ordinary register operand are not supported and fault.
+*/
+
+#ifndef BATCH_VM_H
+#define BATCH_VM_H
+
+#include <stdint.h>
+#include <memory>
+#include <string>
+#include <vector>
+#include "SAD_VM.h"
+
+// lanes run by one SIMD operation, 128 bits being there on every x86-64 system
+const size_t SAD_LANE_WIDTH = 4;
+typedef uint32_t sad_lanes __attribute__((vector_size(SAD_LANE_WIDTH * 4)));
+typedef int32_t sad_signed_lanes __attribute__((vector_size(SAD_LANE_WIDTH * 4)));
+
+// lanes run together, the rest waiting for the next warp, so that lanes running longer than the
+// others only hold up a few of them
+const size_t SAD_WARP_LANES = 256;
+
+// default data memory size of each lane in words, for programs without a data section as large
+const size_t SAD_BATCH_MEMORY_WORDS = 1 << 12;
+
+// default stack size of each lane in words
+const size_t SAD_BATCH_STACK_WORDS = 256;
+
+class sad_batch_vm {
+    protected:
+        enum lane_status { RUNNING, HALTED, FAULTED };
+        // values left for the input port of a lane
+        struct lane_input {
+            const int32_t* values;
+            size_t size, next;
+        };
+
+        std::vector<sad_decoded> decoded; // with trailing HALT
+        sad_image image; // data section the lanes start from, code is only kept for decoding
+        size_t lanes, padded; // padded rounds lanes up to whole SIMD operations
+        size_t groups; // SIMD operations per row
+        size_t memory_words; // as asked for, 0 for the default
+        size_t memory_size; // rows allocated so far
+        size_t memory_limit; // rows lanes may address
+        size_t stack_words;
+        std::vector<sad_lanes> regs; // 16 rows
+        std::vector<sad_lanes> cond; // all ones in lanes where the last comparison held
+        std::vector<sad_lanes> ra;
+        std::vector<sad_lanes> mask; // lanes being run, all ones or zero
+        std::vector<sad_lanes> taken; // lanes going to a branch's target
+        std::vector<uint32_t> mem; // memory_size rows
+        std::unique_ptr<uint32_t[]> stack; // stack_words rows
+        std::vector<uint32_t> stack_top, pc;
+        std::vector<uint8_t> status;
+        std::vector<lane_input> inputs;
+        std::vector<std::string> outputs, errors;
+        std::vector<uint64_t> counts; // instructions executed per lane
+        size_t warp_begin, warp_end; // lanes of the warp being run
+        size_t member_begin, member_end; // first lane in mask and one past the last
+        size_t running; // lanes of the warp neither halted nor faulted
+        size_t group; // lanes in mask
+
+        sad_lanes* row(int reg) { return &regs[reg * groups]; }
+        uint32_t* lane_row(int reg) { return (uint32_t*)row(reg); }
+        bool member(size_t lane) const { return ((const uint32_t*)mask.data())[lane] != 0; }
+        void fault(size_t lane, const std::string& msg, uint32_t at, uint64_t steps);
+        void run_group(uint32_t start, uint32_t waiting);
+    public:
+        // memory_words of 0 sizes data memory to the data section of the program loaded, or to
+        // SAD_BATCH_MEMORY_WORDS if that is larger
+        sad_batch_vm(size_t lanes, size_t memory_words = 0, size_t stack_words = SAD_BATCH_STACK_WORDS);
+
+        // loads an object file's code, with every lane starting from its data section
+        void load(const sad_image& image);
+        // puts every lane back at the start of the program, keeping the inputs it was given
+        void reset();
+        // reads the input port of lane from the count values, faulting the lane once they run out
+        void set_input(size_t lane, const int32_t* values, size_t count);
+        // runs until every lane has halted or faulted, returning false if any lane faulted
+        bool run();
+
+        size_t size() const { return lanes; }
+        // everything a lane wrote to the output ports
+        const std::string& output(size_t lane) const { return outputs[lane]; }
+        // why a lane stopped on a fault, empty when it halted
+        const std::string& error(size_t lane) const { return errors[lane]; }
+        uint64_t executed(size_t lane) const { return counts[lane]; }
+};
+
+#endif
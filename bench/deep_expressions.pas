@@ -0,0 +1,18 @@
+PROGRAM deepexpressions;
+VAR a, b, c, d, e, f, g, h, i, n, s: INTEGER;
+BEGIN
+  n := 200000;
+  s := 0;
+  i := 0;
+  a := 3; b := 5; c := 7; d := 11; e := 13; f := 17; g := 19; h := 23;
+  WHILE i < n DO
+  BEGIN
+    s := s + ((((a + i) * (b - 1) - (c + (d * (e - (f + (g * (h - i / 7))))))) / 3)
+           + ((a * (b * (c * (d + (e - (f - (g + h))))))) - ((i - a) * ((b + c) * ((d - e) * (f + g)))))
+           - (((((((((a + b) - c) + d) - e) + f) - g) + h) - i) * 2));
+    IF s > 100000000 THEN s := s - 100000000;
+    IF s < 0 - 100000000 THEN s := s + 100000000;
+    i := i + 1
+  END;
+  WRITELN s
+END.
@@ -0,0 +1,72 @@
+#!/usr/bin/env python3
+"""
+generate.py
+Author: Kristopher J. Carroll
+Description:
+    Writes synthetic programs far larger than anything written by hand, for measuring how the front
+    end and code generation scale. Each program is a long run of blocks over a pool of variables,
+    every block a short WHILE loop with an IF inside and a few assignments with nested expressions,
+    so the source is big but the program still finishes quickly on the VM. The output is the same
+    on every run, so results can be compared across builds.
+
+    Usage: python3 generate.py [directory]   (defaults to bench/generated)
+"""
+
+import os
+import random
+import sys
+
+# blocks per generated program, about 8 lines each
+SIZES = [2000, 20000, 100000]
+VARIABLES = 40
+
+
+def name(k):
+    # identifiers are letters only
+    letters = 'abcdefghijklmnopqrstuvwxyz'
+    return 'g' + letters[k // 26] + letters[k % 26]
+
+
+def expression(rng, depth):
+    if depth == 0 or rng.random() < 0.3:
+        if rng.random() < 0.6:
+            return name(rng.randrange(VARIABLES))
+        return str(rng.randrange(1, 100))
+    op = rng.choice('+-*+-')
+    return '(%s %s %s)' % (expression(rng, depth - 1), op, expression(rng, depth - 1))
+
+
+def generate(path, blocks):
+    rng = random.Random(blocks)
+    with open(path, 'w') as out:
+        out.write('PROGRAM generated;\n')
+        out.write('VAR %s, i, s: INTEGER;\n' % ', '.join(name(k) for k in range(VARIABLES)))
+        out.write('BEGIN\n')
+        for k in range(VARIABLES):
+            out.write('  %s := %d;\n' % (name(k), k))
+        out.write('  s := 0;\n')
+        for b in range(blocks):
+            target = name(rng.randrange(VARIABLES))
+            out.write('  i := 0;\n')
+            out.write('  WHILE i < %d DO\n' % rng.randrange(1, 4))
+            out.write('  BEGIN\n')
+            out.write('    %s := %s / %d;\n' % (target, expression(rng, 3), rng.randrange(2, 9)))
+            out.write('    IF %s > %s THEN s := s + 1 ELSE s := s - %s;\n'
+                      % (name(rng.randrange(VARIABLES)), expression(rng, 2), name(rng.randrange(VARIABLES))))
+            out.write('    i := i + 1\n')
+            out.write('  END;\n')
+        out.write('  WRITELN s\n')
+        out.write('END.\n')
+
+
+def main():
+    directory = sys.argv[1] if len(sys.argv) > 1 else os.path.join(os.path.dirname(__file__), 'generated')
+    os.makedirs(directory, exist_ok=True)
+    for blocks in SIZES:
+        path = os.path.join(directory, 'generated_%d.pas' % blocks)
+        generate(path, blocks)
+        print('wrote %s' % path)
+
+
+if __name__ == '__main__':
+    main()
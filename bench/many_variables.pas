@@ -0,0 +1,157 @@
+PROGRAM manyvariables;
+VAR vaa, vab, vac, vad, vae, vaf, vag, vah, vba, vbb, vbc, vbd, vbe, vbf, vbg, vbh, vca, vcb, vcc, vcd, vce, vcf, vcg, vch, vda, vdb, vdc, vdd, vde, vdf, vdg, vdh, vea, veb, vec, ved, vee, vef, veg, veh, vfa, vfb, vfc, vfd, vfe, vff, vfg, vfh, i, n, s: INTEGER;
+BEGIN
+  vaa := 1;
+  vab := 2;
+  vac := 3;
+  vad := 4;
+  vae := 5;
+  vaf := 6;
+  vag := 7;
+  vah := 8;
+  vba := 9;
+  vbb := 10;
+  vbc := 11;
+  vbd := 12;
+  vbe := 13;
+  vbf := 14;
+  vbg := 15;
+  vbh := 16;
+  vca := 17;
+  vcb := 18;
+  vcc := 19;
+  vcd := 20;
+  vce := 21;
+  vcf := 22;
+  vcg := 23;
+  vch := 24;
+  vda := 25;
+  vdb := 26;
+  vdc := 27;
+  vdd := 28;
+  vde := 29;
+  vdf := 30;
+  vdg := 31;
+  vdh := 32;
+  vea := 33;
+  veb := 34;
+  vec := 35;
+  ved := 36;
+  vee := 37;
+  vef := 38;
+  veg := 39;
+  veh := 40;
+  vfa := 41;
+  vfb := 42;
+  vfc := 43;
+  vfd := 44;
+  vfe := 45;
+  vff := 46;
+  vfg := 47;
+  vfh := 48;
+  n := 20000;
+  i := 0;
+  WHILE i < n DO
+  BEGIN
+    vaa := vab + vah - i;
+    vab := vac - vba + i;
+    vac := vad + vbb + i;
+    vad := vae - vbc - i;
+    vae := vaf + vbd + i;
+    vaf := vag - vbe + i;
+    vag := vah + vbf - i;
+    vah := vba - vbg + i;
+    vba := vbb + vbh + i;
+    vbb := vbc - vca - i;
+    vbc := vbd + vcb + i;
+    vbd := vbe - vcc + i;
+    vbe := vbf + vcd - i;
+    vbf := vbg - vce + i;
+    vbg := vbh + vcf + i;
+    vbh := vca - vcg - i;
+    vca := vcb + vch + i;
+    vcb := vcc - vda + i;
+    vcc := vcd + vdb - i;
+    vcd := vce - vdc + i;
+    vce := vcf + vdd + i;
+    vcf := vcg - vde - i;
+    vcg := vch + vdf + i;
+    vch := vda - vdg + i;
+    vda := vdb + vdh - i;
+    vdb := vdc - vea + i;
+    vdc := vdd + veb + i;
+    vdd := vde - vec - i;
+    vde := vdf + ved + i;
+    vdf := vdg - vee + i;
+    vdg := vdh + vef - i;
+    vdh := vea - veg + i;
+    vea := veb + veh + i;
+    veb := vec - vfa - i;
+    vec := ved + vfb + i;
+    ved := vee - vfc + i;
+    vee := vef + vfd - i;
+    vef := veg - vfe + i;
+    veg := veh + vff + i;
+    veh := vfa - vfg - i;
+    vfa := vfb + vfh + i;
+    vfb := vfc - vaa + i;
+    vfc := vfd + vab - i;
+    vfd := vfe - vac + i;
+    vfe := vff + vad + i;
+    vff := vfg - vae - i;
+    vfg := vfh + vaf + i;
+    vfh := vaa - vag + i;
+    IF vaa > 1000000 THEN vaa := 0;
+    i := i + 1
+  END;
+  s := 0;
+  s := s + vaa;
+  s := s + vab;
+  s := s + vac;
+  s := s + vad;
+  s := s + vae;
+  s := s + vaf;
+  s := s + vag;
+  s := s + vah;
+  s := s + vba;
+  s := s + vbb;
+  s := s + vbc;
+  s := s + vbd;
+  s := s + vbe;
+  s := s + vbf;
+  s := s + vbg;
+  s := s + vbh;
+  s := s + vca;
+  s := s + vcb;
+  s := s + vcc;
+  s := s + vcd;
+  s := s + vce;
+  s := s + vcf;
+  s := s + vcg;
+  s := s + vch;
+  s := s + vda;
+  s := s + vdb;
+  s := s + vdc;
+  s := s + vdd;
+  s := s + vde;
+  s := s + vdf;
+  s := s + vdg;
+  s := s + vdh;
+  s := s + vea;
+  s := s + veb;
+  s := s + vec;
+  s := s + ved;
+  s := s + vee;
+  s := s + vef;
+  s := s + veg;
+  s := s + veh;
+  s := s + vfa;
+  s := s + vfb;
+  s := s + vfc;
+  s := s + vfd;
+  s := s + vfe;
+  s := s + vff;
+  s := s + vfg;
+  s := s + vfh;
+  WRITELN s
+END.
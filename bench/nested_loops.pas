@@ -0,0 +1,25 @@
+PROGRAM nestedloops;
+VAR i, j, k, n, s, t: INTEGER;
+BEGIN
+  n := 120;
+  s := 0;
+  i := 0;
+  WHILE i < n DO
+  BEGIN
+    j := 0;
+    WHILE j < n DO
+    BEGIN
+      k := 0;
+      t := i + j;
+      WHILE k < n DO
+      BEGIN
+        s := s + t * k - (k - j);
+        k := k + 1
+      END;
+      j := j + 1
+    END;
+    IF s > 1000000 THEN s := s - 1000000;
+    i := i + 1
+  END;
+  WRITELN s
+END.
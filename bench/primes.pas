@@ -0,0 +1,30 @@
+PROGRAM primes;
+VAR n, candidate, divisor, prime, count, last: INTEGER;
+BEGIN
+  n := 200000;
+  count := 0;
+  last := 0;
+  candidate := 2;
+  WHILE candidate < n DO
+  BEGIN
+    prime := 1;
+    divisor := 2;
+    WHILE divisor <= candidate / divisor DO
+    BEGIN
+      IF candidate / divisor * divisor <= candidate - 1 THEN divisor := divisor + 1
+      ELSE
+      BEGIN
+        prime := 0;
+        divisor := candidate
+      END
+    END;
+    IF prime > 0 THEN
+    BEGIN
+      count := count + 1;
+      last := candidate
+    END;
+    candidate := candidate + 1
+  END;
+  WRITELN count;
+  WRITELN last
+END.
@@ -0,0 +1,161 @@
+/*
+cache.cpp
+Author: Kristopher J. Carroll
+Description:
+    Keys, lookups and stores of the compile cache described in cache.h, with the SHA-256 used to
+    name entries.
+*/
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include "cache.h"
+
+// set by the Makefile from the compiler's sources, builds without it share one identity
+#ifndef SAD_COMPILER_ID
+#define SAD_COMPILER_ID "unversioned"
+#endif
+
+// SHA-256 as specified in FIPS 180-4, fed in pieces and finished into a hex digest
+class sha256 {
+    protected:
+        uint32_t state[8];
+        unsigned char block[64];
+        size_t used; // bytes waiting in block
+        uint64_t total; // bytes fed so far
+
+        static uint32_t rotate(uint32_t x, int n) { return (x >> n) | (x << (32 - n)); }
+        void compress(const unsigned char* data) {
+            static const uint32_t k[64] = {
+                0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+                0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+                0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+                0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+                0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+                0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+                0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+                0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+            };
+            uint32_t w[64];
+            for (int i = 0; i < 16; i++) {
+                w[i] = (uint32_t)data[4 * i] << 24 | data[4 * i + 1] << 16 | data[4 * i + 2] << 8 | data[4 * i + 3];
+            }
+            for (int i = 16; i < 64; i++) {
+                uint32_t s0 = rotate(w[i - 15], 7) ^ rotate(w[i - 15], 18) ^ (w[i - 15] >> 3);
+                uint32_t s1 = rotate(w[i - 2], 17) ^ rotate(w[i - 2], 19) ^ (w[i - 2] >> 10);
+                w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+            }
+            uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+            uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+            for (int i = 0; i < 64; i++) {
+                uint32_t t1 = h + (rotate(e, 6) ^ rotate(e, 11) ^ rotate(e, 25)) + ((e & f) ^ (~e & g)) + k[i] + w[i];
+                uint32_t t2 = (rotate(a, 2) ^ rotate(a, 13) ^ rotate(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+                h = g; g = f; f = e; e = d + t1;
+                d = c; c = b; b = a; a = t1 + t2;
+            }
+            state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+            state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+        }
+    public:
+        sha256() : used(0), total(0) {
+            static const uint32_t initial[8] = {
+                0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+            };
+            memcpy(state, initial, sizeof(state));
+        }
+        void update(const void* data, size_t length) {
+            const unsigned char* bytes = (const unsigned char*)data;
+            total += length;
+            while (length) {
+                // whole blocks are compressed straight from the input
+                if (used == 0 && length >= 64) {
+                    compress(bytes);
+                    bytes += 64;
+                    length -= 64;
+                    continue;
+                }
+                size_t take = std::min(length, 64 - used);
+                memcpy(block + used, bytes, take);
+                used += take;
+                bytes += take;
+                length -= take;
+                if (used == 64) {
+                    compress(block);
+                    used = 0;
+                }
+            }
+        }
+        // a string with its terminating NUL, so consecutive fields cannot run into each other
+        void update(const char* text) { update(text, strlen(text) + 1); }
+        std::string hex() {
+            uint64_t bits = total * 8;
+            unsigned char padding[72] = { 0x80 };
+            size_t pad = used < 56 ? 56 - used : 120 - used;
+            for (int i = 0; i < 8; i++) padding[pad + i] = bits >> (56 - 8 * i);
+            update(padding, pad + 8);
+            std::string digest;
+            char byte[3];
+            for (int i = 0; i < 32; i++) {
+                snprintf(byte, sizeof(byte), "%02x", (state[i / 4] >> (24 - 8 * (i % 4))) & 0xff);
+                digest += byte;
+            }
+            return digest;
+        }
+};
+
+std::string compile_cache::key(const char* text, size_t length, bool optimize) {
+    sha256 hash;
+    hash.update("pascal compile cache");
+    hash.update(SAD_COMPILER_ID);
+    hash.update(std::to_string(SAD_IMAGE_VERSION).c_str());
+    hash.update(optimize ? "peephole" : "no-peephole");
+    hash.update(text, length);
+    return hash.hex();
+}
+
+bool compile_cache::lookup(const std::string& key, sad_image& image) const {
+    // a missing entry is the common case, checked before trying to read one
+    if (access(path(key).c_str(), R_OK) != 0) return false;
+    std::string error;
+    return sad_read_image(path(key), image, error);
+}
+
+// creates directory and any of its parents that are missing
+static bool make_directories(const std::string& directory) {
+    for (size_t slash = directory.find('/', 1); ; slash = directory.find('/', slash + 1)) {
+        std::string prefix = directory.substr(0, slash);
+        if (mkdir(prefix.c_str(), 0777) != 0 && errno != EEXIST) return false;
+        if (slash == std::string::npos) return true;
+    }
+}
+
+bool compile_cache::store(const std::string& key, const sad_image& image, std::string& error) const {
+    if (!make_directories(directory)) {
+        error = "could not create cache directory " + directory;
+        return false;
+    }
+    std::string temporary = path(key) + ".XXXXXX";
+    int fd = mkstemp(&temporary[0]);
+    if (fd < 0) {
+        error = "could not create a file in cache directory " + directory;
+        return false;
+    }
+    // entries are readable by anyone sharing the cache, mkstemp only allows the owner
+    fchmod(fd, 0644);
+    close(fd);
+    if (!sad_write_image(temporary, image, error)) {
+        unlink(temporary.c_str());
+        return false;
+    }
+    if (rename(temporary.c_str(), path(key).c_str()) != 0) {
+        unlink(temporary.c_str());
+        error = "could not store " + path(key);
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,44 @@
+/*
+cache.h
+Author: Kristopher J. Carroll
+Description:
+    On-disk cache of compiled programs used by "pascal --cache directory", so compiling a source
+    that has been compiled before skips parsing and code generation and loads the result instead.
+
+    Entries are object files (see sad_image in SAD_VM.h) named by the SHA-256 of everything the
+    code depends on: the source text, the options it was compiled with, the object file version
+    and the identity of the compiler, which the Makefile derives from the compiler's own sources
+    (SAD_COMPILER_ID). Changing the source, an option or the compiler gives a different name, so
+    entries are never stale and nothing is ever invalidated, old entries are simply not used again
+    and the directory can be cleared at any time.
+
+    Entries are written to a temporary file first and renamed into place, so any number of threads
+    or processes can share a cache and readers never see a half written entry. Object files do not
+    keep the line table, so profiles of programs loaded from the cache have no per-line report.
+*/
+
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stddef.h>
+#include <string>
+#include "SAD_VM.h"
+
+class compile_cache {
+    protected:
+        std::string directory;
+        std::string path(const std::string& key) const { return directory + "/" + key + ".sadbin"; }
+    public:
+        compile_cache(const std::string& directory_) : directory(directory_) { }
+
+        // name of the entry for source text compiled with or without the peephole optimizer
+        static std::string key(const char* text, size_t length, bool optimize);
+
+        // loads the entry for key into image, returning false if there is none
+        bool lookup(const std::string& key, sad_image& image) const;
+        // stores image as the entry for key, creating the directory if needed, returning false and
+        // setting error if it could not be written
+        bool store(const std::string& key, const sad_image& image, std::string& error) const;
+};
+
+#endif
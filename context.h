@@ -0,0 +1,77 @@
+/*
+context.h
+Author: Kristopher J. Carroll
+Description:
+    Everything belonging to the compilation of one program: the arena holding its tree and
+    identifiers, its symbol table, the parsed program and any errors reported along the way. The
+    scanner generated from pascal.l is reentrant and the parser generated from pascal.y is pure, both
+    keeping their state in the context they are given instead of in globals, so any number of
+    contexts can parse and compile programs at the same time on different threads.
+
+    Errors are collected in the context instead of ending the process, the parser stops at the first
+    one and parse() reports whether a program was produced.
+
+    With a pass timer attached (see instrument.h), parse() times reading the source, scanning it on
+    its own and parsing it as separate phases, with symbol table work timed inside the parse.
+*/
+
+#ifndef CONTEXT_H
+#define CONTEXT_H
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include "arena.h"
+#include "AST.h"
+#include "instrument.h"
+#include "source.h"
+#include "symbols.h"
+
+class compile_context {
+    public:
+        arena pool; // storage for all nodes, statement vectors and identifiers of the program
+        symbol_table symbols;
+        program* root; // parsed program, NULL until parsing succeeds
+        std::vector<std::string> errors;
+        int line; // current source line while scanning
+        pass_timer* timer; // phases being timed, NULL when not instrumented
+
+        compile_context() : symbols(pool), root(NULL), line(1), timer(NULL) { }
+        ~compile_context() { delete root; }
+
+        // parses a whole program from in, which is mapped or read into memory first and scanned in
+        // place, returning false if it failed with errors
+        bool parse(FILE* in);
+        // the same for source already in memory, used when it is needed for something else as well
+        bool parse(source_buffer& source);
+        // only scans in the same way, returning the number of tokens or -1 if the source could not be
+        // read (used to time the scanner on its own)
+        long scan(FILE* in);
+
+        // records an error found at the given source line
+        void error(const std::string& message, int at_line) {
+            char prefix[32];
+            snprintf(prefix, sizeof(prefix), "line %d: ", at_line);
+            errors.push_back(prefix + message);
+        }
+        // allocates an empty statement list inside the arena
+        statement_vector* new_statement_vector() {
+            return new (pool) statement_vector(arena_allocator<statement*>(pool));
+        }
+        // declares the variable named by a token, reporting an error if it was declared before
+        bool declare(source_span name, int at_line) {
+            pass_timer::section timing(timer, "symbol resolution");
+            if (symbols.declare(name.text, name.length)) return true;
+            error("symbol previously declared: " + std::string(name.text, name.length), at_line);
+            return false;
+        }
+        // the variable named by a token, reporting an error if there is none
+        var_node* lookup(source_span name, int at_line) {
+            pass_timer::section timing(timer, "symbol resolution");
+            var_node* var = symbols.lookup(name.text, name.length);
+            if (!var) error("symbol not previously declared: " + std::string(name.text, name.length), at_line);
+            return var;
+        }
+};
+
+#endif
@@ -0,0 +1,568 @@
+/*
+driver.cpp
+Author: Kristopher J. Carroll
+Description:
+    Command line driver for the compiler. Without file arguments it works as it always has,
+    reading one program from stdin, optionally evaluating or running it, and printing the compiled
+    code in copy-paste format or writing it to a binary object file (see sad_image in SAD_VM.h).
+
+    Given source files or directories (searched recursively for .pas files) it compiles all of them
+    in one process instead, each with its own compilation context, spread over a work-stealing
+    thread pool (see thread_pool.h). Each program's code is written next to its source with the
+    extension replaced by .sad, and a summary with the time taken for each file is printed once the
+    whole batch is done, in the order the files were given.
+
+    With --bench the same files are measured instead of compiled: for each program the time spent
+    scanning, parsing and generating code (the best of a few rounds), the number of instructions
+    emitted, and how long the VM takes to run it along with the instructions it executes per second.
+    bench/ holds a corpus for this, run with make bench.
+
+    Programs run on the native VM (-r or -x) can be profiled with --profile, which writes a report
+    of where execution went (see sad_write_profile in SAD_VM.h) to a file, or to stdout for -. For
+    programs compiled in the same run the report maps instructions back to their source lines.
+    --jit runs them translated to x86-64 code instead of on the interpreter (see jit.h).
+
+    --batch inputs runs one instance of the program for every line of the file inputs, each reading
+    the values on its line from the input port, all of them in lockstep on the batch VM (see
+    batch_vm.h). The output of every instance follows a line naming it. Profiling and the JIT do
+    not apply to batch runs.
+
+    --time-passes reports the time, heap allocations and peak heap growth of every phase of
+    compiling a single program to stderr, as a table or with --time-passes=json as JSON (see
+    instrument.h). The parse phase includes the scanner it drives, so the parsing itself is the
+    difference to the lex phase, which scans the source once on its own beforehand.
+
+    --cache directory keeps compiled programs in an on-disk cache (see cache.h), both for single
+    programs and batches. A source compiled before with the same options is loaded from there
+    instead of being parsed and compiled again. Tracing and the evaluators need the tree, so a
+    program run with -t, -e or -E is always compiled.
+*/
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "AST.h"
+#include "batch_vm.h"
+#include "cache.h"
+#include "context.h"
+#include "evaluator.h"
+#include "output.h"
+#include "SAD_VM.h"
+#include "thread_pool.h"
+
+// FILE receiving the output of programs run on the native VM, and the machine's memory sizes
+static FILE* vm_output = stdout;
+static size_t vm_memory_words = SAD_MEMORY_WORDS;
+static size_t vm_stack_words = SAD_STACK_WORDS;
+// the same for the batch VM, where they take after the program unless given (see batch_vm.h)
+static size_t batch_memory_words = 0;
+static size_t batch_stack_words = SAD_BATCH_STACK_WORDS;
+// file holding the inputs of each instance for --batch, NULL when running a single instance
+static const char* batch_file = NULL;
+// whether the native VM runs programs translated to x86-64 code (see jit.h)
+static bool use_jit = false;
+// file receiving the profile report of programs run on the native VM, NULL when not profiling
+static const char* profile_file = NULL;
+// whether compiled code goes through the peephole optimizer (see peephole.h)
+static bool optimize = true;
+// directory holding the compile cache (see cache.h), NULL when not caching
+static const char* cache_directory = NULL;
+
+// executes an instance of an object file image for every line of batch_file at once, each line holding
+// the instance's input values
+static int run_batch(const sad_image& image) {
+    std::ifstream in(batch_file);
+    if (!in) {
+        printf("Error: could not open %s\n", batch_file);
+        return 1;
+    }
+    std::vector<std::vector<int32_t> > inputs;
+    for (std::string line; std::getline(in, line); ) {
+        std::istringstream values(line);
+        inputs.push_back(std::vector<int32_t>());
+        for (int32_t value; values >> value; ) inputs.back().push_back(value);
+    }
+    sad_batch_vm vm(inputs.size(), batch_memory_words, batch_stack_words);
+    vm.load(image);
+    for (size_t i = 0; i < inputs.size(); i++) vm.set_input(i, inputs[i].data(), inputs[i].size());
+    bool ok = vm.run();
+    for (size_t i = 0; i < inputs.size(); i++) {
+        fprintf(vm_output, "Instance %zu:\n", i);
+        fputs(vm.output(i).c_str(), vm_output);
+        fflush(vm_output);
+        if (!vm.error(i).empty()) printf("Error during VM execution: %s\n", vm.error(i).c_str());
+    }
+    return ok ? 0 : 1;
+}
+
+// executes an object file image on the native VM
+static int run_native(const sad_image& image) {
+    if (batch_file) return run_batch(image);
+    sad_vm vm(vm_memory_words, vm_stack_words);
+    vm.set_jit(use_jit);
+    vm.set_output(vm_output);
+    vm.load(image);
+    bool ok;
+    if (profile_file) {
+        // the report is written even when the program faults, it may show how it got there
+        sad_profile profile;
+        ok = vm.run(profile);
+        FILE* report = strcmp(profile_file, "-") ? fopen(profile_file, "w") : stdout;
+        if (!report) {
+            printf("Error: could not open %s\n", profile_file);
+            return 1;
+        }
+        sad_write_profile(report, image.code, image.lines, profile, 20);
+        if (report != stdout) fclose(report);
+    }
+    else {
+        ok = vm.run();
+    }
+    if (!ok) {
+        printf("Error during VM execution: %s\n", vm.error().c_str());
+        return 1;
+    }
+    return 0;
+}
+
+// result of compiling one file of a batch
+struct batch_job {
+    std::string source;
+    std::string output;
+    std::vector<std::string> errors;
+    std::vector<std::string> warnings; // problems that did not stop the file compiling
+    size_t instructions;
+    int removed; // by the peephole optimizer
+    int dead_stores; // removed by dead store elimination
+    bool cached; // loaded from the compile cache instead of compiled
+    double milliseconds;
+
+    batch_job(const std::string& source_) : source(source_), instructions(0), removed(0), dead_stores(0), cached(false), milliseconds(0) { }
+};
+
+static bool has_suffix(const std::string& name, const std::string& suffix) {
+    return name.size() >= suffix.size() && name.compare(name.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+// adds every .pas file under path to sources, sorted so batches come out the same on every run
+static void find_sources(const std::string& path, std::vector<std::string>& sources) {
+    DIR* dir = opendir(path.c_str());
+    if (!dir) {
+        sources.push_back(path);
+        return;
+    }
+    std::vector<std::string> found;
+    while (struct dirent* entry = readdir(dir)) {
+        if (entry->d_name[0] == '.') continue;
+        std::string name = path + "/" + entry->d_name;
+        struct stat info;
+        if (stat(name.c_str(), &info) != 0) continue;
+        if (S_ISDIR(info.st_mode) || has_suffix(name, ".pas")) found.push_back(name);
+    }
+    closedir(dir);
+    std::sort(found.begin(), found.end());
+    for (size_t i = 0; i < found.size(); i++) find_sources(found[i], sources);
+}
+
+static double milliseconds_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// writes code in the copy-paste format, as program::print_code does
+static void print_image(std::ostream& out, const sad_image& image) {
+    for (size_t x = 0; x < image.code.size(); x++) {
+        out << sad_disassemble(image.code[x]) << (x + 1 < image.code.size() ? ",\n" : "\n");
+    }
+}
+
+// parses and compiles one file, writing its code out, with everything it needs kept in its own context
+static void compile_file(batch_job& job) {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    job.output = (has_suffix(job.source, ".pas") ? job.source.substr(0, job.source.size() - 4) : job.source) + ".sad";
+    FILE* in = fopen(job.source.c_str(), "r");
+    source_buffer source;
+    if (!in) {
+        job.errors.push_back("could not open " + job.source);
+    }
+    else if (!source.load(in)) {
+        fclose(in);
+        job.errors.push_back("could not read " + job.source);
+    }
+    else {
+        // a mapped source stays mapped once the file is closed
+        fclose(in);
+        std::string key;
+        sad_image image;
+        if (cache_directory) {
+            key = compile_cache::key(source.get_text(), source.size(), optimize);
+            job.cached = compile_cache(cache_directory).lookup(key, image);
+        }
+        compile_context context;
+        if (!job.cached) {
+            if (!context.parse(source)) {
+                job.errors = context.errors;
+            }
+            else {
+                context.root->compile(optimize);
+                job.removed = context.root->get_removed();
+                job.dead_stores = context.root->get_dead_stores();
+                image = context.root->get_image();
+                std::string error;
+                if (cache_directory && !compile_cache(cache_directory).store(key, image, error)) job.warnings.push_back(error);
+            }
+        }
+        if (job.errors.empty()) {
+            job.instructions = image.code.size();
+            std::ofstream out(job.output.c_str());
+            print_image(out, image);
+            if (!out) job.errors.push_back("could not write " + job.output);
+        }
+    }
+    job.milliseconds = milliseconds_since(start);
+}
+
+static int compile_batch(const std::vector<std::string>& paths, unsigned threads) {
+    std::vector<std::string> sources;
+    for (size_t i = 0; i < paths.size(); i++) find_sources(paths[i], sources);
+    std::vector<batch_job> jobs(sources.begin(), sources.end());
+    if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+    threads = std::min<size_t>(threads, std::max<size_t>(jobs.size(), 1));
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    work_stealing_pool pool(threads);
+    pool.run(jobs.size(), [&jobs](size_t i) { compile_file(jobs[i]); });
+    double wall = milliseconds_since(start);
+
+    // every file gets its own line, failures followed by their errors
+    int failed = 0, cached = 0;
+    double total = 0;
+    for (size_t i = 0; i < jobs.size(); i++) {
+        batch_job& job = jobs[i];
+        total += job.milliseconds;
+        if (job.errors.empty() && job.cached) {
+            cached++;
+            printf("%9.3f ms  %6zu instructions (cached)     %s -> %s\n", job.milliseconds, job.instructions,
+                job.source.c_str(), job.output.c_str());
+        }
+        else if (job.errors.empty()) {
+            printf("%9.3f ms  %6zu instructions (%d removed, %d dead stores)  %s -> %s\n", job.milliseconds,
+                job.instructions, job.removed, job.dead_stores, job.source.c_str(), job.output.c_str());
+        }
+        else {
+            failed++;
+            printf("%9.3f ms  %6s failed%*s  %s\n", job.milliseconds, "", 14, "", job.source.c_str());
+            for (size_t e = 0; e < job.errors.size(); e++) printf("    error: %s\n", job.errors[e].c_str());
+        }
+        for (size_t w = 0; w < job.warnings.size(); w++) printf("    warning: %s\n", job.warnings[w].c_str());
+    }
+    printf("%zu files, %d failed, ", jobs.size(), failed);
+    if (cache_directory) printf("%d from cache, ", cached);
+    printf("%.3f ms compiling, %.3f ms wall time on %u threads\n", total, wall, threads);
+    return failed ? 1 : 0;
+}
+
+// timings of each stage, the best of this many rounds so a stray context switch does not count
+static const int bench_rounds = 3;
+
+static int count_lines(FILE* in) {
+    int lines = 0;
+    for (int c; (c = getc(in)) != EOF; ) if (c == '\n') lines++;
+    rewind(in);
+    return lines;
+}
+
+// measures one program through every stage, printing its row of the report
+static bool bench_file(const std::string& source) {
+    FILE* in = fopen(source.c_str(), "r");
+    if (!in) {
+        printf("%s: could not open\n", source.c_str());
+        return false;
+    }
+    int lines = count_lines(in);
+    long tokens = 0;
+    double lex = 0, parse = 0, codegen = 0;
+    size_t instructions = 0;
+    sad_image image;
+    for (int round = 0; round < bench_rounds; round++) {
+        // the scanner on its own, then the parser with the scanner feeding it, then code generation
+        compile_context scanned;
+        rewind(in);
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        tokens = scanned.scan(in);
+        double lex_round = milliseconds_since(start);
+
+        compile_context context;
+        rewind(in);
+        start = std::chrono::steady_clock::now();
+        bool parsed = context.parse(in);
+        double parse_round = milliseconds_since(start);
+        if (!parsed) {
+            printf("%s: %s\n", source.c_str(), context.errors.empty() ? "parse failed" : context.errors[0].c_str());
+            fclose(in);
+            return false;
+        }
+
+        start = std::chrono::steady_clock::now();
+        context.root->compile(optimize);
+        double codegen_round = milliseconds_since(start);
+
+        if (round == 0 || lex_round < lex) lex = lex_round;
+        if (round == 0 || parse_round < parse) parse = parse_round;
+        if (round == 0 || codegen_round < codegen) codegen = codegen_round;
+        instructions = context.root->get_code()->size();
+        if (round == 0) image = context.root->get_image();
+    }
+    fclose(in);
+
+    // the program runs once, with its output thrown away
+    sad_vm vm(vm_memory_words, vm_stack_words);
+    vm.set_jit(use_jit);
+    FILE* null_output = fopen("/dev/null", "w");
+    vm.set_output(null_output ? null_output : stdout);
+    vm.load(image);
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    bool ran = vm.run();
+    double run = milliseconds_since(start);
+    if (null_output) fclose(null_output);
+
+    // parsing drives the scanner itself, so its time here is what it adds on top of scanning
+    printf("%8d %9ld %9.3f %9.3f %10.3f %8zu %10.3f %11llu %9.1f  %s%s\n", lines, tokens, lex,
+        std::max(parse - lex, 0.0), codegen, instructions, run, (unsigned long long)vm.executed,
+        run > 0 ? vm.executed / run / 1000 : 0, source.c_str(), ran ? "" : "  (VM error)");
+    if (!ran) printf("    error: %s\n", vm.error().c_str());
+    return ran;
+}
+
+static int bench(const std::vector<std::string>& paths) {
+    std::vector<std::string> sources;
+    for (size_t i = 0; i < paths.size(); i++) find_sources(paths[i], sources);
+    printf("%8s %9s %9s %9s %10s %8s %10s %11s %9s  %s\n", "lines", "tokens", "lex ms", "parse ms", "codegen ms",
+        "emitted", "vm ms", "executed", "Minstr/s", "program");
+    int failed = 0;
+    for (size_t i = 0; i < sources.size(); i++) if (!bench_file(sources[i])) failed++;
+    return failed ? 1 : 0;
+}
+
+int main(int argc, char** argv) {
+    bool run_vm = false;
+    bool trace = false;
+    bool eval = false;
+    bool eval_tree = false;
+    const char* sad_file = NULL;
+    const char* object_file = NULL;
+    const char* output_file = NULL;
+    unsigned threads = 0;
+    bool benchmark = false;
+    const char* time_passes = NULL; // report format, text or json
+    std::vector<std::string> sources;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "-r" || arg == "--run") {
+            run_vm = true;
+        }
+        else if (arg == "-t" || arg == "--trace") {
+            trace = true;
+        }
+        else if (arg == "-e" || arg == "--eval") {
+            eval = true;
+        }
+        else if (arg == "-E" || arg == "--eval-tree") {
+            eval_tree = true;
+        }
+        else if ((arg == "-x" || arg == "--exec") && i + 1 < argc) {
+            sad_file = argv[++i];
+        }
+        else if ((arg == "-o" || arg == "--output") && i + 1 < argc) {
+            object_file = argv[++i];
+        }
+        else if (arg == "--no-peephole") {
+            optimize = false;
+        }
+        else if (arg == "--vm-output" && i + 1 < argc) {
+            output_file = argv[++i];
+        }
+        else if (arg == "--jit") {
+            use_jit = true;
+        }
+        else if (arg == "--profile" && i + 1 < argc) {
+            profile_file = argv[++i];
+        }
+        else if (arg == "--vm-memory" && i + 1 < argc) {
+            vm_memory_words = batch_memory_words = strtoul(argv[++i], NULL, 0);
+        }
+        else if (arg == "--vm-stack" && i + 1 < argc) {
+            vm_stack_words = batch_stack_words = strtoul(argv[++i], NULL, 0);
+        }
+        else if ((arg == "-j" || arg == "--jobs") && i + 1 < argc) {
+            threads = atoi(argv[++i]);
+        }
+        else if (arg == "--time-passes" || arg == "--time-passes=text" || arg == "--time-passes=json") {
+            time_passes = arg == "--time-passes=json" ? "json" : "text";
+        }
+        else if (arg == "--bench") {
+            benchmark = true;
+        }
+        else if (arg == "--batch" && i + 1 < argc) {
+            batch_file = argv[++i];
+        }
+        else if (arg == "--cache" && i + 1 < argc) {
+            cache_directory = argv[++i];
+        }
+        else if (arg[0] != '-') {
+            sources.push_back(arg);
+        }
+        else {
+            printf("Usage: %s [-r|--run] [-e|--eval] [-E|--eval-tree] [-t|--trace] [-o|--output file.sadbin] [-x|--exec file.sad|file.sadbin]\n", argv[0]);
+            printf("       %*s [--no-peephole] [--time-passes[=text|json]] [--cache directory]\n", (int)strlen(argv[0]), "");
+            printf("       %*s [--vm-output file] [--vm-memory words] [--vm-stack words] [--jit] [--profile file|-] [--batch inputs] < program.pas\n", (int)strlen(argv[0]), "");
+            printf("       %s [-j|--jobs threads] [--no-peephole] [--cache directory] file.pas|directory ...\n", argv[0]);
+            printf("       %s --bench [--no-peephole] [--jit] file.pas|directory ...\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if (benchmark) return bench(sources);
+    if (!sources.empty()) return compile_batch(sources, threads);
+
+    // output of the VM goes to a file of its own instead of being mixed in with the compiler's
+    if (output_file && !(vm_output = fopen(output_file, "w"))) {
+        printf("Error: could not open %s\n", output_file);
+        return 1;
+    }
+
+    // running an existing SAD VM program, either an object file or in tuple format, without compiling anything
+    if (sad_file) {
+        sad_image image;
+        std::string error;
+        if (has_suffix(sad_file, ".sadbin")) {
+            if (!sad_read_image(sad_file, image, error)) {
+                printf("Error: %s\n", error.c_str());
+                return 1;
+            }
+            return run_native(image);
+        }
+        std::ifstream in(sad_file);
+        if (!in) {
+            printf("Error: could not open %s\n", sad_file);
+            return 1;
+        }
+        std::stringstream text;
+        text << in.rdbuf();
+        if (!sad_assemble(text.str(), image.code, error)) {
+            printf("Error during assembly: %s\n", error.c_str());
+            return 1;
+        }
+        return run_native(image);
+    }
+
+    // phases are timed from here on, the report is written to stderr once the code is out
+    std::unique_ptr<pass_timer> timer(time_passes ? new pass_timer() : NULL);
+    source_buffer source;
+    pass_begin(timer.get(), "read source");
+    if (!source.load(stdin)) {
+        printf("Error during parse: could not read source\n");
+        return 1;
+    }
+
+    // a program that was compiled before goes straight on to being written out and run
+    bool cacheable = cache_directory && !trace && !eval && !eval_tree;
+    std::string key;
+    sad_image image;
+    bool cached = false;
+    if (cacheable) {
+        pass_begin(timer.get(), "cache lookup");
+        key = compile_cache::key(source.get_text(), source.size(), optimize);
+        cached = compile_cache(cache_directory).lookup(key, image);
+    }
+    int status = 0;
+    compile_context context;
+    context.timer = timer.get();
+    if (!cached) {
+        if (!context.parse(source)) {
+            for (size_t e = 0; e < context.errors.size(); e++) {
+                printf("Error during parse: %s\n", context.errors[e].c_str());
+            }
+            return 1;
+        }
+        program* root = context.root;
+
+        // printing the parsed program and tracing its evaluation statement by statement (for debugging)
+        if (trace) root->evaluate();
+
+        // running the program directly on the tree, from freshly zeroed variables
+        if (eval_tree) {
+            for (int slot = 0; slot < context.symbols.size(); slot++) context.symbols.variable(slot)->val = 0;
+            std::cout << "Evaluating program:" << std::endl;
+            output_buffer out;
+            if (!root->execute(out)) status = 1;
+            std::cout << std::endl;
+        }
+
+        // running the program from bytecode lowered from the tree
+        if (eval) {
+            eval_code bytecode;
+            root->lower(bytecode);
+            std::cout << "Evaluating program:" << std::endl;
+            output_buffer out;
+            std::string error;
+            if (!eval_run(bytecode, out, error)) {
+                std::cout << "Error during evaluation: " << error << std::endl;
+                status = 1;
+            }
+            std::cout << std::endl;
+        }
+
+        root->compile(optimize, timer.get());
+        image = root->get_image();
+        if (cacheable) {
+            pass_begin(timer.get(), "cache store");
+            std::string error;
+            if (!compile_cache(cache_directory).store(key, image, error)) printf("Warning: %s\n", error.c_str());
+        }
+    }
+
+    pass_begin(timer.get(), "emission");
+    if (object_file) {
+        std::string error;
+        if (!sad_write_image(object_file, image, error)) {
+            printf("Error: %s\n", error.c_str());
+            return 1;
+        }
+        std::cout << "Wrote " << image.code.size() << " instructions to " << object_file << std::endl;
+    }
+    else {
+        std::cout << "Copy/paste format for input into SADGE VM:" << std::endl;
+        print_image(std::cout, image);
+    }
+    std::cout.flush();
+    if (timer) {
+        timer->end();
+        if (!strcmp(time_passes, "json")) timer->write_json(stderr);
+        else timer->write_text(stderr);
+    }
+    if (cached) std::cout << "Loaded compiled code from cache" << std::endl;
+    else if (optimize) {
+        std::cout << "Peephole optimizer removed " << context.root->get_removed() << " instructions" << std::endl;
+        std::cout << "Dead store elimination removed " << context.root->get_dead_stores() << " instructions" << std::endl;
+    }
+
+    if (run_vm) {
+        std::cout << std::endl << "Running compiled program on native SAD VM:" << std::endl;
+        std::cout.flush();
+        if (run_native(image)) status = 1;
+    }
+
+    // the context releases the whole AST in one shot when it goes out of scope
+    return status;
+}
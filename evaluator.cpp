@@ -0,0 +1,89 @@
+/*
+evaluator.cpp
+Author: Kristopher J. Carroll
+Description:
+    Dispatch loop for the bytecode described in evaluator.h, using the same threaded or switch
+    dispatch as the SAD VM (see SAD_VM.h).
+*/
+
+#include "evaluator.h"
+
+#if (defined(__GNUC__) || defined(__clang__)) && !defined(SAD_VM_SWITCH_DISPATCH)
+#define EVAL_THREADED 1
+#endif
+
+#ifdef EVAL_THREADED
+#define EVAL_CASE(name) L_##name:
+#define EVAL_NEXT goto *ip->label
+#else
+#define EVAL_CASE(name) case EVAL_##name:
+#define EVAL_NEXT goto next
+#endif
+
+bool eval_run(eval_code& code, output_buffer& out, std::string& error) {
+    if (code.ops.empty() || code.ops.back().op != EVAL_HALT) code.emit(EVAL_HALT);
+#ifdef EVAL_THREADED
+    #define EVAL_OP_LABEL(name, effect) &&L_##name,
+    static const void* const labels[EVAL_COUNT] = { EVAL_OPS(EVAL_OP_LABEL) };
+    #undef EVAL_OP_LABEL
+    for (size_t i = 0; i < code.ops.size(); i++) code.ops[i].label = labels[code.ops[i].op];
+#endif
+    std::vector<int32_t> slot_storage(code.slots + 1, 0);
+    std::vector<int32_t> stack_storage(code.max_depth + 1, 0);
+    int32_t* slots = slot_storage.data();
+    // sp points at the top value, the bottom entry is never used
+    int32_t* sp = stack_storage.data();
+    const eval_op* base = code.ops.data();
+    const eval_op* ip = base;
+    bool ok = true;
+
+#ifdef EVAL_THREADED
+    EVAL_NEXT;
+#else
+    next:
+    switch (ip->op) {
+#endif
+        EVAL_CASE(CONST) *++sp = ip->a; ip++; EVAL_NEXT;
+        EVAL_CASE(LOAD) *++sp = slots[ip->a]; ip++; EVAL_NEXT;
+        EVAL_CASE(STORE) slots[ip->a] = *sp--; ip++; EVAL_NEXT;
+        EVAL_CASE(ADD) sp--; *sp = (uint32_t)sp[0] + (uint32_t)sp[1]; ip++; EVAL_NEXT;
+        EVAL_CASE(SUB) sp--; *sp = (uint32_t)sp[0] - (uint32_t)sp[1]; ip++; EVAL_NEXT;
+        EVAL_CASE(MULT) sp--; *sp = (uint32_t)sp[0] * (uint32_t)sp[1]; ip++; EVAL_NEXT;
+        EVAL_CASE(DIV)
+            sp--;
+            if (sp[1] == 0) { ok = false; goto zero; }
+            *sp = sad_div(sp[0], sp[1]);
+            ip++;
+            EVAL_NEXT;
+        EVAL_CASE(LT) sp--; *sp = sp[0] < sp[1]; ip++; EVAL_NEXT;
+        EVAL_CASE(GT) sp--; *sp = sp[0] > sp[1]; ip++; EVAL_NEXT;
+        EVAL_CASE(LTE) sp--; *sp = sp[0] <= sp[1]; ip++; EVAL_NEXT;
+        EVAL_CASE(GTE) sp--; *sp = sp[0] >= sp[1]; ip++; EVAL_NEXT;
+        EVAL_CASE(ADDK) *sp = (uint32_t)*sp + (uint32_t)ip->a; ip++; EVAL_NEXT;
+        EVAL_CASE(MULTK) *sp = (uint32_t)*sp * (uint32_t)ip->a; ip++; EVAL_NEXT;
+        EVAL_CASE(DIVK)
+            if (ip->a == 0) { ok = false; goto zero; }
+            *sp = sad_div(*sp, ip->a);
+            ip++;
+            EVAL_NEXT;
+        EVAL_CASE(STEP) slots[ip->a] = (uint32_t)slots[ip->a] + (uint32_t)ip->b; ip++; EVAL_NEXT;
+        EVAL_CASE(JMP) ip = base + ip->a; EVAL_NEXT;
+        EVAL_CASE(JF) ip = *sp-- ? ip + 1 : base + ip->a; EVAL_NEXT;
+        EVAL_CASE(JT) ip = *sp-- ? base + ip->a : ip + 1; EVAL_NEXT;
+        EVAL_CASE(BLT) sp -= 2; ip = sp[1] < sp[2] ? base + ip->a : ip + 1; EVAL_NEXT;
+        EVAL_CASE(BGT) sp -= 2; ip = sp[1] > sp[2] ? base + ip->a : ip + 1; EVAL_NEXT;
+        EVAL_CASE(BLTE) sp -= 2; ip = sp[1] <= sp[2] ? base + ip->a : ip + 1; EVAL_NEXT;
+        EVAL_CASE(BGTE) sp -= 2; ip = sp[1] >= sp[2] ? base + ip->a : ip + 1; EVAL_NEXT;
+        EVAL_CASE(WRITE) out.write_int(*sp--); ip++; EVAL_NEXT;
+        EVAL_CASE(HALT) goto done;
+#ifndef EVAL_THREADED
+        default: goto done;
+    }
+#endif
+
+    zero:
+    error = "division by zero";
+    done:
+    out.flush();
+    return ok;
+}
@@ -0,0 +1,95 @@
+/*
+evaluator.h
+Author: Kristopher J. Carroll
+Description:
+    Flat bytecode used to run programs in-process without going through SAD VM code generation.
+    The AST is lowered once (see the lower() functions in AST.h) into a single vector of post-order
+    stack instructions, with every variable turned into an index into a dense slot array. Running
+    the bytecode is then a tight dispatch loop over contiguous memory instead of virtual calls
+    across nodes scattered through the arena.
+
+    A few fused instructions keep the common cases short: arithmetic with a constant operand works
+    on the top of the stack in place, x := x + c updates its slot directly, and conditions compare
+    and branch in one instruction. Arithmetic follows SAD VM exactly (32-bit wrapping, division
+    rounding towards negative infinity) so the output matches compiled programs.
+*/
+
+#ifndef EVALUATOR_H
+#define EVALUATOR_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "SAD_VM.h"
+#include "output.h"
+
+// bytecode instructions with their effect on the stack depth
+//     CONST a    push a
+//     LOAD a     push slot a
+//     STORE a    pop into slot a
+//     ADD ... GTE          pop two, push the result (comparisons push 0 or 1)
+//     ADDK, MULTK, DIVK a  apply constant a to the top of the stack
+//     STEP a b   add b to slot a
+//     JMP a      jump to a
+//     JF, JT a   pop, jump to a when zero (JF) or non-zero (JT)
+//     BLT ... BGTE a       pop two, jump to a when the comparison holds
+//     WRITE      pop and write the value
+#define EVAL_OPS(X) \
+    X(CONST, 1) X(LOAD, 1) X(STORE, -1) \
+    X(ADD, -1) X(SUB, -1) X(MULT, -1) X(DIV, -1) X(LT, -1) X(GT, -1) X(LTE, -1) X(GTE, -1) \
+    X(ADDK, 0) X(MULTK, 0) X(DIVK, 0) X(STEP, 0) \
+    X(JMP, 0) X(JF, -1) X(JT, -1) X(BLT, -2) X(BGT, -2) X(BLTE, -2) X(BGTE, -2) \
+    X(WRITE, -1) X(HALT, 0)
+
+#define EVAL_OP_ENUM(name, effect) EVAL_##name,
+enum eval_opcode { EVAL_OPS(EVAL_OP_ENUM) EVAL_COUNT };
+#undef EVAL_OP_ENUM
+
+struct eval_op {
+    const void* label; // handler address when using threaded dispatch
+    uint8_t op;
+    int32_t a, b;
+};
+
+// comparison and compare-and-branch instructions for a SAD VM comparison mode
+inline int eval_comp_op(int mode) {
+    return mode == COMP_LT ? EVAL_LT : mode == COMP_GT ? EVAL_GT : mode == COMP_LTE ? EVAL_LTE : EVAL_GTE;
+}
+inline int eval_branch_op(int mode) {
+    return mode == COMP_LT ? EVAL_BLT : mode == COMP_GT ? EVAL_BGT : mode == COMP_LTE ? EVAL_BLTE : EVAL_BGTE;
+}
+
+// bytecode for a whole program, built by the lower() functions of the AST
+class eval_code {
+    protected:
+        int depth; // stack depth at the end of the code emitted so far
+    public:
+        std::vector<eval_op> ops;
+        int slots; // variables in the slot array, indexed by symbol table slot
+        int max_depth; // deepest the stack gets, the evaluator allocates it up front
+
+        eval_code() : depth(0), slots(0), max_depth(0) { }
+        // appends an instruction, returning its index so jumps can be patched later
+        int emit(int op, int32_t a = 0, int32_t b = 0) {
+            #define EVAL_OP_EFFECT(name, effect) effect,
+            static const int effects[EVAL_COUNT] = { EVAL_OPS(EVAL_OP_EFFECT) };
+            #undef EVAL_OP_EFFECT
+            eval_op o;
+            o.label = NULL;
+            o.op = op;
+            o.a = a;
+            o.b = b;
+            ops.push_back(o);
+            depth += effects[op];
+            if (depth > max_depth) max_depth = depth;
+            return ops.size() - 1;
+        }
+        int here() const { return ops.size(); }
+        // points the jump at index at to target
+        void patch(int at, int target) { ops[at].a = target; }
+};
+
+// runs lowered bytecode from zeroed variables, returning false and setting error on a fault
+bool eval_run(eval_code& code, output_buffer& out, std::string& error);
+
+#endif
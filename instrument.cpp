@@ -0,0 +1,159 @@
+/*
+instrument.cpp
+Author: Kristopher J. Carroll
+Description:
+    Counting operator new and delete and the pass timer reports described in instrument.h.
+*/
+
+#include <malloc.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <algorithm>
+#include <new>
+#include "instrument.h"
+
+// only ever set while a single compilation runs on the main thread, see instrument.h
+static bool counting = false;
+static heap_counters counters = { 0, 0, 0, 0 };
+
+// the library (see libpascal.h) is built without any of this, it would replace the allocator of the
+// host program
+#ifndef SAD_NO_HEAP_COUNTING
+static void* counted_malloc(size_t size) {
+    void* p = malloc(size ? size : 1);
+    if (p && counting) {
+        size_t usable = malloc_usable_size(p);
+        counters.allocations++;
+        counters.allocated += usable;
+        counters.live += usable;
+        counters.peak = std::max(counters.peak, counters.live);
+    }
+    return p;
+}
+
+static void counted_free(void* p) {
+    if (p && counting) counters.live -= malloc_usable_size(p);
+    free(p);
+}
+
+// every form is replaced so that no allocation is ever released by a mismatched delete
+void* operator new(size_t size) {
+    void* p = counted_malloc(size);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+void* operator new[](size_t size) {
+    void* p = counted_malloc(size);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+void* operator new(size_t size, const std::nothrow_t&) noexcept { return counted_malloc(size); }
+void* operator new[](size_t size, const std::nothrow_t&) noexcept { return counted_malloc(size); }
+void operator delete(void* p) noexcept { counted_free(p); }
+void operator delete[](void* p) noexcept { counted_free(p); }
+void operator delete(void* p, const std::nothrow_t&) noexcept { counted_free(p); }
+void operator delete[](void* p, const std::nothrow_t&) noexcept { counted_free(p); }
+#endif
+
+heap_counters heap_now() { return counters; }
+
+int64_t set_heap_peak(int64_t peak) {
+    int64_t old = counters.peak;
+    counters.peak = std::max(peak, counters.live);
+    return old;
+}
+
+static double milliseconds_between(std::chrono::steady_clock::time_point from, std::chrono::steady_clock::time_point to) {
+    return std::chrono::duration<double, std::milli>(to - from).count();
+}
+
+pass_timer::pass_timer() : current(-1) { counting = true; }
+
+pass_timer::~pass_timer() {
+    end();
+    counting = false;
+}
+
+void pass_timer::begin(const std::string& name) {
+    end();
+    pass p = { name, -1, 0, 0, 0, 0 };
+    passes.push_back(p);
+    current = passes.size() - 1;
+    heap = heap_now();
+    set_heap_peak(heap.live);
+    start = std::chrono::steady_clock::now();
+}
+
+void pass_timer::end() {
+    if (current < 0) return;
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    heap_counters at = heap_now();
+    pass& p = passes[current];
+    p.milliseconds = milliseconds_between(start, now);
+    p.allocations = at.allocations - heap.allocations;
+    p.allocated = at.allocated - heap.allocated;
+    p.peak = at.peak - heap.live;
+    current = -1;
+}
+
+void pass_timer::add_section(const char* name, std::chrono::steady_clock::time_point from, const heap_counters& at) {
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    heap_counters after = heap_now();
+    set_heap_peak(std::max(at.peak, after.peak));
+    if (current < 0) return;
+    size_t i = current + 1;
+    while (i < passes.size() && passes[i].name != name) i++;
+    if (i == passes.size()) {
+        pass p = { name, current, 0, 0, 0, 0 };
+        passes.push_back(p);
+    }
+    pass& p = passes[i];
+    p.milliseconds += milliseconds_between(from, now);
+    p.allocations += after.allocations - at.allocations;
+    p.allocated += after.allocated - at.allocated;
+    p.peak = std::max(p.peak, after.peak - at.live);
+}
+
+// largest resident set the process has had, in kilobytes
+static long max_resident() {
+    struct rusage usage;
+    return getrusage(RUSAGE_SELF, &usage) == 0 ? usage.ru_maxrss : 0;
+}
+
+void pass_timer::write_text(FILE* out) const {
+    double total = 0;
+    fprintf(out, "%-32s %10s %10s %12s %12s\n", "phase", "ms", "allocs", "bytes", "peak bytes");
+    for (size_t i = 0; i < passes.size(); i++) {
+        const pass& p = passes[i];
+        if (p.parent < 0) total += p.milliseconds;
+        std::string name = (p.parent < 0 ? "" : "  ") + p.name;
+        fprintf(out, "%-32s %10.3f %10llu %12llu %12lld\n", name.c_str(), p.milliseconds,
+            (unsigned long long)p.allocations, (unsigned long long)p.allocated, (long long)p.peak);
+    }
+    fprintf(out, "%-32s %10.3f\n", "total", total);
+    fprintf(out, "maximum resident set %ld KB\n", max_resident());
+}
+
+// names are fixed strings chosen by the compiler, but quotes and backslashes are escaped anyway
+static std::string json_string(const std::string& text) {
+    std::string quoted = "\"";
+    for (size_t i = 0; i < text.size(); i++) {
+        if (text[i] == '"' || text[i] == '\\') quoted += '\\';
+        quoted += text[i];
+    }
+    return quoted + "\"";
+}
+
+void pass_timer::write_json(FILE* out) const {
+    double total = 0;
+    fprintf(out, "{\"passes\": [");
+    for (size_t i = 0; i < passes.size(); i++) {
+        const pass& p = passes[i];
+        if (p.parent < 0) total += p.milliseconds;
+        fprintf(out, "%s\n  {\"name\": %s, \"parent\": %s, \"milliseconds\": %.6f, \"allocations\": %llu, "
+            "\"allocated_bytes\": %llu, \"peak_bytes\": %lld}", i ? "," : "", json_string(p.name).c_str(),
+            p.parent < 0 ? "null" : json_string(passes[p.parent].name).c_str(), p.milliseconds,
+            (unsigned long long)p.allocations, (unsigned long long)p.allocated, (long long)p.peak);
+    }
+    fprintf(out, "\n], \"total_milliseconds\": %.6f, \"max_resident_kb\": %ld}\n", total, max_resident());
+}
@@ -0,0 +1,95 @@
+/*
+instrument.h
+Author: Kristopher J. Carroll
+Description:
+    Instrumentation behind "pascal --time-passes", recording for every phase of a compilation its
+    wall time, how many heap allocations it made, how many bytes those were and how far the heap
+    grew above where it stood when the phase started. The report comes out as a table or as JSON
+    for scripts comparing compilations of sources of very different sizes.
+
+    Allocations are counted by the replacement operator new and delete in instrument.cpp, which
+    only count while a pass_timer exists, so compilations without one pay a single test per
+    allocation. The arena (arena.h) takes its blocks from operator new as well, so the tree built
+    while parsing is included. Counting is not thread safe, so a pass_timer is only used when
+    compiling a single program. Builds with SAD_NO_HEAP_COUNTING, like the library, leave operator
+    new alone and report no allocations.
+
+    Phases follow each other, each begin() ending the phase before it. Work scattered through a
+    phase, like symbol lookups made by the parser, is timed in sections that add up into a nested
+    entry of the phase they happen in.
+*/
+
+#ifndef INSTRUMENT_H
+#define INSTRUMENT_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <chrono>
+#include <string>
+#include <vector>
+
+// heap activity seen by operator new and delete while counting
+struct heap_counters {
+    uint64_t allocations;
+    uint64_t allocated; // bytes handed out
+    int64_t live; // bytes currently allocated, relative to when counting started
+    int64_t peak; // highest live since the peak was last set
+};
+
+// the counters as they stand now
+heap_counters heap_now();
+// sets the peak to track from, returning the peak it replaces
+int64_t set_heap_peak(int64_t peak);
+
+class pass_timer {
+    public:
+        struct pass {
+            std::string name;
+            int parent; // index of the enclosing phase for nested sections, -1 for phases
+            double milliseconds;
+            uint64_t allocations;
+            uint64_t allocated;
+            int64_t peak; // furthest the heap grew above its size at the start
+        };
+        // times one section of work, adding it to the nested entry named name of the current phase
+        class section {
+            protected:
+                pass_timer* timer;
+                const char* name;
+                std::chrono::steady_clock::time_point start;
+                heap_counters heap;
+            public:
+                section(pass_timer* timer_, const char* name_) : timer(timer_), name(name_) {
+                    if (timer) {
+                        // the section tracks its own peak, the phase's is put back afterwards
+                        heap = heap_now();
+                        set_heap_peak(heap.live);
+                        start = std::chrono::steady_clock::now();
+                    }
+                }
+                ~section() { if (timer) timer->add_section(name, start, heap); }
+        };
+    protected:
+        std::vector<pass> passes;
+        int current; // phase in progress, -1 if none
+        std::chrono::steady_clock::time_point start; // of the current phase
+        heap_counters heap; // at the start of the current phase
+        void add_section(const char* name, std::chrono::steady_clock::time_point from, const heap_counters& at);
+    public:
+        pass_timer();
+        ~pass_timer();
+        // starts the phase called name, ending the one in progress
+        void begin(const std::string& name);
+        // ends the phase in progress
+        void end();
+        const std::vector<pass>& get_passes() const { return passes; }
+
+        void write_text(FILE* out) const;
+        void write_json(FILE* out) const;
+};
+
+// phase boundaries for code that may or may not be instrumented
+inline void pass_begin(pass_timer* timer, const char* name) { if (timer) timer->begin(name); }
+inline void pass_end(pass_timer* timer) { if (timer) timer->end(); }
+
+#endif
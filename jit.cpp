@@ -0,0 +1,568 @@
+/*
+jit.cpp
+Author: Kristopher J. Carroll
+Description:
+    x86-64 translation of SAD VM programs and the loop running them, described in jit.h.
+*/
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+#include "jit.h"
+#include "SAD_VM.h"
+
+#if defined(__x86_64__) && (defined(__linux__) || defined(__APPLE__)) && !defined(SAD_VM_NO_JIT)
+#define SAD_JIT_X86_64 1
+#include <sys/mman.h>
+#endif
+
+// everything the generated code reads and writes besides host registers, addressed from rbx
+struct sad_jit_state {
+    int32_t regs[16];
+    int32_t cond;
+    int32_t ra;
+    uint64_t executed;
+    const void* const* entries; // code address of every instruction, for RET
+    int32_t* memory;
+    uint32_t exit_pc; // instruction the generated code stopped at
+    uint32_t exit_reason;
+};
+
+// why the generated code returned
+enum sad_jit_exit { JIT_HALT, JIT_STEP, JIT_BAD_ADDRESS, JIT_DIVISION_BY_ZERO };
+
+class sad_jit {
+    public:
+        unsigned char* code;
+        size_t capacity;
+        std::vector<const void*> entries; // one per instruction plus the trailing halt
+        size_t memory_words; // data memory size the bounds checks were generated for
+        uint32_t (*enter)(sad_jit_state* state, const void* target);
+
+        sad_jit() : code(NULL), capacity(0), memory_words(0), enter(NULL) { }
+        ~sad_jit() {
+#ifdef SAD_JIT_X86_64
+            if (code) munmap(code, capacity);
+#endif
+        }
+};
+
+sad_vm::~sad_vm() { discard_jit(); }
+
+void sad_vm::discard_jit() {
+    delete jit;
+    jit = NULL;
+}
+
+#ifdef SAD_JIT_X86_64
+
+bool sad_jit_available() { return true; }
+
+enum jit_host_register { RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8, R9, R10, R11, R12, R13, R14, R15 };
+
+// condition codes as used by Jcc and SETcc
+enum jit_condition { CC_B = 0x2, CC_AE = 0x3, CC_E = 0x4, CC_NE = 0x5, CC_S = 0x8, CC_NS = 0x9,
+                  CC_L = 0xc, CC_GE = 0xd, CC_LE = 0xe, CC_G = 0xf };
+
+// registers handed out to SAD registers, the rest have fixed jobs
+static const int jit_pool[] = { RSI, RDI, R8, R9, R10, R11, R12, R13, R14 };
+static const int jit_pool_size = sizeof(jit_pool) / sizeof(jit_pool[0]);
+
+// a SAD register, or any other 32-bit state field, either in a host register or at rbx + disp
+struct jit_operand {
+    bool host;
+    int reg;
+    int disp;
+};
+
+static inline jit_operand jit_field(size_t offset) {
+    jit_operand o = { false, 0, (int)offset };
+    return o;
+}
+
+// a jump or call to patch once the code it goes to has been placed
+struct jit_fixup {
+    size_t at; // position of the 32-bit displacement
+    uint32_t target; // instruction index
+};
+
+// a fault check leaving the generated code, with the instructions of its block that had not run yet
+struct jit_fault {
+    size_t at;
+    uint32_t pc;
+    uint32_t reason;
+    uint32_t unexecuted;
+};
+
+class x86_assembler {
+    public:
+        std::vector<unsigned char> bytes;
+
+        size_t position() const { return bytes.size(); }
+        void byte(int b) { bytes.push_back((unsigned char)b); }
+        void word32(uint32_t w) { for (int i = 0; i < 4; i++) byte(w >> (8 * i)); }
+        void patch32(size_t at, uint32_t w) { for (int i = 0; i < 4; i++) bytes[at + i] = w >> (8 * i); }
+        // points the rel32 at at to the given position
+        void link32(size_t at, size_t to) { patch32(at, (uint32_t)(to - (at + 4))); }
+        void link8(size_t at) { bytes[at] = (unsigned char)(position() - (at + 1)); }
+
+        // opcode with a ModRM byte, reg being a register number or an opcode extension
+        void op(int opcode, int reg, const jit_operand& o, bool wide = false) {
+            int base = o.host ? o.reg : RBX;
+            int rex = 0x40 | (wide ? 8 : 0) | ((reg & 8) ? 4 : 0) | ((base & 8) ? 1 : 0);
+            if (rex != 0x40) byte(rex);
+            if (opcode > 0xff) byte(opcode >> 8);
+            byte(opcode & 0xff);
+            if (o.host) {
+                byte(0xc0 | ((reg & 7) << 3) | (o.reg & 7));
+            }
+            else {
+                byte(0x40 | ((reg & 7) << 3) | RBX);
+                byte(o.disp);
+            }
+        }
+        void load(int reg, const jit_operand& o) { if (!o.host || o.reg != reg) op(0x8b, reg, o); }
+        void store(const jit_operand& o, int reg) { if (!o.host || o.reg != reg) op(0x89, reg, o); }
+        void load_imm(const jit_operand& o, int32_t imm) {
+            op(0xc7, 0, o);
+            word32(imm);
+        }
+        // ALU operation with an immediate, extension 0 for ADD, 5 for SUB and 7 for CMP
+        void alu_imm(int extension, const jit_operand& o, int32_t imm) {
+            if (imm >= -128 && imm <= 127) {
+                op(0x83, extension, o);
+                byte(imm);
+            }
+            else {
+                op(0x81, extension, o);
+                word32(imm);
+            }
+        }
+        size_t jump() {
+            byte(0xe9);
+            word32(0);
+            return position() - 4;
+        }
+        size_t jump_if(int cc) {
+            byte(0x0f);
+            byte(0x80 | cc);
+            word32(0);
+            return position() - 4;
+        }
+        size_t jump_if8(int cc) {
+            byte(0x70 | cc);
+            byte(0);
+            return position() - 1;
+        }
+        size_t jump8() {
+            byte(0xeb);
+            byte(0);
+            return position() - 1;
+        }
+};
+
+class jit_translator {
+    protected:
+        const std::vector<sad_decoded>& decoded;
+        uint32_t size;
+        size_t memory_words;
+        x86_assembler x;
+        jit_operand location[16]; // where each SAD register lives
+        std::vector<uint8_t> leader; // instructions starting a basic block
+        std::vector<size_t> offsets; // code position of each instruction
+        std::vector<jit_fixup> jumps;
+        std::vector<jit_fault> faults;
+        std::vector<size_t> to_epilogue;
+        uint32_t block_start, block_length;
+
+        static bool leaves(int handler) {
+            return handler == H_OUT || handler == H_CHAR || handler == H_IN || handler == H_PUSH ||
+                   handler == H_POP || handler == H_SLOW || handler == H_BAD;
+        }
+        static bool transfers(int handler) {
+            return handler == H_LOOP || handler == H_JMP || handler == H_JMPC || handler == H_JMPR || handler == H_RET;
+        }
+
+        // the registers each instruction uses, for choosing which ones get host registers
+        static int registers_used(const sad_decoded& d, int* regs) {
+            switch (d.handler) {
+                case H_MOV: case H_LOAD: case H_STOR:
+                case H_EQ: case H_NEQ: case H_LT: case H_GT: case H_LTE: case H_GTE:
+                    regs[0] = d.a; regs[1] = d.b; return 2;
+                case H_ADD: case H_SUB: case H_MULT: case H_DIV:
+                    regs[0] = d.a; regs[1] = d.b; regs[2] = d.c; return 3;
+                case H_LIMM: case H_ADDI: case H_SUBI: case H_MULTI: case H_DIVI: case H_INC: case H_DEC:
+                    regs[0] = d.a; return 1;
+                case H_CNT: case H_LOOP:
+                    regs[0] = REG_CNT; return 1;
+                default: return 0;
+            }
+        }
+
+        void assign_registers() {
+            // loop nesting depth of every instruction, from the backward jumps closing each loop
+            std::vector<int> depth(size + 1, 0);
+            for (uint32_t pc = 0; pc < size; pc++) {
+                const sad_decoded& d = decoded[pc];
+                if ((d.handler == H_LOOP || d.handler == H_JMP || d.handler == H_JMPC) && (uint32_t)d.imm <= pc) {
+                    depth[d.imm]++;
+                    depth[pc + 1]--;
+                }
+            }
+            uint64_t weight[16] = { 0 };
+            int nesting = 0;
+            for (uint32_t pc = 0; pc < size; pc++) {
+                nesting += depth[pc];
+                int regs[3];
+                int count = registers_used(decoded[pc], regs);
+                for (int r = 0; r < count; r++) weight[regs[r]] += (uint64_t)1 << (3 * std::min(nesting, 6));
+            }
+            int order[15];
+            for (int r = 0; r < 15; r++) order[r] = r + 1;
+            std::stable_sort(order, order + 15, [&weight](int x, int y) { return weight[x] > weight[y]; });
+            for (int r = 0; r < 16; r++) location[r] = jit_field(offsetof(sad_jit_state, regs) + 4 * r);
+            // PC is never read by the generated code, the instructions using it are left to step()
+            for (int h = 0; h < jit_pool_size && weight[order[h]]; h++) {
+                location[order[h]].host = true;
+                location[order[h]].reg = jit_pool[h];
+            }
+        }
+
+        void find_leaders(uint32_t start) {
+            leader.assign(size + 1, 0);
+            leader[0] = leader[start] = 1;
+            for (uint32_t pc = 0; pc < size; pc++) {
+                int handler = decoded[pc].handler;
+                if (transfers(handler) || leaves(handler)) leader[pc + 1] = 1;
+                if (transfers(handler) && handler != H_RET) leader[decoded[pc].imm] = 1;
+            }
+        }
+
+        void jump_to(uint32_t target) { jumps.push_back(jit_fixup{ x.jump(), target }); }
+        void jump_if_to(int cc, uint32_t target) { jumps.push_back(jit_fixup{ x.jump_if(cc), target }); }
+        void fault_if(int cc, uint32_t pc, uint32_t reason) {
+            faults.push_back(jit_fault{ x.jump_if(cc), pc, reason, block_start + block_length - pc });
+        }
+        // leaves the generated code at pc for the given reason
+        void exit_to_vm(uint32_t pc, uint32_t reason) {
+            x.load_imm(jit_field(offsetof(sad_jit_state, exit_pc)), pc);
+            x.load_imm(jit_field(offsetof(sad_jit_state, exit_reason)), reason);
+            to_epilogue.push_back(x.jump());
+        }
+
+        // eax = b / divisor rounded towards negative infinity, the divisor already in ecx and nonzero
+        void floor_divide(bool may_be_minus_one) {
+            size_t general = 0, negated = 0;
+            if (may_be_minus_one) {
+                // INT_MIN / -1 traps on x86, negating wraps the same way the interpreter does
+                x.alu_imm(7, jit_operand{ true, RCX, 0 }, -1);
+                general = x.jump_if8(CC_NE);
+                x.byte(0xf7); x.byte(0xd8); // neg eax
+                negated = x.jump8();
+                x.link8(general);
+            }
+            x.byte(0x99); // cdq
+            x.byte(0xf7); x.byte(0xf9); // idiv ecx
+            // a nonzero remainder with the opposite sign of the divisor means rounding down one more
+            x.byte(0x85); x.byte(0xd2); // test edx, edx
+            size_t exact = x.jump_if8(CC_E);
+            x.byte(0x31); x.byte(0xca); // xor edx, ecx
+            size_t same_sign = x.jump_if8(CC_NS);
+            x.byte(0xff); x.byte(0xc8); // dec eax
+            x.link8(exact);
+            x.link8(same_sign);
+            if (may_be_minus_one) x.link8(negated);
+        }
+
+        // eax = the memory address in register reg, leaving when it is out of range
+        void checked_address(int reg, uint32_t pc) {
+            x.load(RAX, location[reg]);
+            x.byte(0x3d); // cmp eax, imm32
+            x.word32(memory_words);
+            fault_if(CC_AE, pc, JIT_BAD_ADDRESS);
+        }
+
+        void translate(uint32_t pc) {
+            const sad_decoded& d = decoded[pc];
+            const jit_operand& a = location[d.a];
+            const jit_operand& b = location[d.b];
+            const jit_operand& c = location[d.c];
+            static const int comparisons[6] = { CC_E, CC_NE, CC_L, CC_G, CC_LE, CC_GE };
+            switch (d.handler) {
+                case H_MOV:
+                    if (d.a == d.b) break;
+                    if (b.host) x.store(a, b.reg);
+                    else if (a.host) x.load(a.reg, b);
+                    else {
+                        x.load(RAX, b);
+                        x.store(a, RAX);
+                    }
+                    break;
+                case H_LOAD:
+                    checked_address(d.b, pc);
+                    x.byte(0x41); x.byte(0x8b); x.byte(0x04); x.byte(0x87); // mov eax, [r15 + rax * 4]
+                    x.store(a, RAX);
+                    break;
+                case H_STOR:
+                    checked_address(d.a, pc);
+                    x.load(RCX, b);
+                    x.byte(0x41); x.byte(0x89); x.byte(0x0c); x.byte(0x87); // mov [r15 + rax * 4], ecx
+                    break;
+                case H_LIMM:
+                case H_CNT:
+                    x.load_imm(d.handler == H_CNT ? location[REG_CNT] : a, d.imm);
+                    break;
+                case H_ADD:
+                case H_SUB:
+                case H_MULT: {
+                    static const int opcodes[3] = { 0x03, 0x2b, 0x0faf };
+                    x.load(RAX, b);
+                    x.op(opcodes[d.handler - H_ADD], RAX, c);
+                    x.store(a, RAX);
+                    break;
+                }
+                case H_DIV:
+                    x.load(RCX, c);
+                    x.byte(0x85); x.byte(0xc9); // test ecx, ecx
+                    fault_if(CC_E, pc, JIT_DIVISION_BY_ZERO);
+                    x.load(RAX, b);
+                    floor_divide(true);
+                    x.store(a, RAX);
+                    break;
+                case H_ADDI:
+                    x.alu_imm(0, a, d.imm);
+                    break;
+                case H_SUBI:
+                    x.alu_imm(5, a, d.imm);
+                    break;
+                case H_MULTI:
+                    x.op(0x69, RAX, a); // imul eax, a, imm32
+                    x.word32(d.imm);
+                    x.store(a, RAX);
+                    break;
+                case H_DIVI:
+                    if (d.imm == 0) {
+                        faults.push_back(jit_fault{ x.jump(), pc, JIT_DIVISION_BY_ZERO, block_start + block_length - pc });
+                        break;
+                    }
+                    x.load(RAX, a);
+                    if (d.imm == -1) {
+                        x.byte(0xf7); x.byte(0xd8); // neg eax
+                    }
+                    else {
+                        x.byte(0xb9); // mov ecx, imm32
+                        x.word32(d.imm);
+                        floor_divide(false);
+                    }
+                    x.store(a, RAX);
+                    break;
+                case H_EQ: case H_NEQ: case H_LT: case H_GT: case H_LTE: case H_GTE: {
+                    int cc = comparisons[d.handler - H_EQ];
+                    x.load(RAX, a);
+                    x.op(0x3b, RAX, b); // cmp eax, b
+                    x.byte(0x0f); x.byte(0x90 | cc); x.byte(0xc0); // setcc al
+                    x.byte(0x0f); x.byte(0xb6); x.byte(0xe8); // movzx ebp, al
+                    // the flags still hold the comparison when its JMPC comes straight after
+                    if (pc + 1 < size && decoded[pc + 1].handler == H_JMPC && !leader[pc + 1]) {
+                        offsets[pc + 1] = x.position();
+                        jump_if_to(cc ^ 1, decoded[pc + 1].imm);
+                        fused = true;
+                    }
+                    break;
+                }
+                case H_LOOP:
+                    x.alu_imm(5, location[REG_CNT], 1);
+                    jump_if_to(CC_NE, d.imm);
+                    break;
+                case H_JMP:
+                    jump_to(d.imm);
+                    break;
+                case H_JMPC:
+                    x.byte(0x85); x.byte(0xed); // test ebp, ebp
+                    jump_if_to(CC_E, d.imm);
+                    break;
+                case H_JMPR:
+                    x.load_imm(jit_field(offsetof(sad_jit_state, ra)), pc + 1);
+                    jump_to(d.imm);
+                    break;
+                case H_RET:
+                    x.load(RAX, jit_field(offsetof(sad_jit_state, ra)));
+                    x.byte(0x3d); // cmp eax, imm32
+                    x.word32(size);
+                    jump_if_to(CC_AE, size);
+                    x.byte(0x48); x.byte(0x8b); x.byte(0x4b); x.byte(offsetof(sad_jit_state, entries)); // mov rcx, [rbx + entries]
+                    x.byte(0xff); x.byte(0x24); x.byte(0xc1); // jmp [rcx + rax * 8]
+                    break;
+                case H_INC:
+                    x.alu_imm(0, a, 1);
+                    break;
+                case H_DEC:
+                    x.alu_imm(5, a, 1);
+                    break;
+                default:
+                    exit_to_vm(pc, JIT_STEP);
+                    break;
+            }
+        }
+
+        void prologue() {
+            x.byte(0x53); x.byte(0x55); // push rbx, push rbp
+            for (int r = R12; r <= R15; r++) { x.byte(0x41); x.byte(0x50 | (r & 7)); }
+            x.byte(0x48); x.byte(0x89); x.byte(0xfb); // mov rbx, rdi
+            x.byte(0x48); x.byte(0x89); x.byte(0xf0); // mov rax, rsi
+            x.byte(0x4c); x.byte(0x8b); x.byte(0x7b); x.byte(offsetof(sad_jit_state, memory)); // mov r15, [rbx + memory]
+            x.load(RBP, jit_field(offsetof(sad_jit_state, cond)));
+            for (int r = 0; r < 16; r++) {
+                if (location[r].host) x.op(0x8b, location[r].reg, jit_field(offsetof(sad_jit_state, regs) + 4 * r));
+            }
+            x.byte(0xff); x.byte(0xe0); // jmp rax
+        }
+
+        void epilogue() {
+            for (int r = 0; r < 16; r++) {
+                if (location[r].host) x.op(0x89, location[r].reg, jit_field(offsetof(sad_jit_state, regs) + 4 * r));
+            }
+            x.store(jit_field(offsetof(sad_jit_state, cond)), RBP);
+            x.load(RAX, jit_field(offsetof(sad_jit_state, exit_reason)));
+            for (int r = R15; r >= R12; r--) { x.byte(0x41); x.byte(0x58 | (r & 7)); }
+            x.byte(0x5d); x.byte(0x5b); // pop rbp, pop rbx
+            x.byte(0xc3); // ret
+        }
+
+        bool fused; // the instruction after the one just translated has been translated with it
+    public:
+        jit_translator(const std::vector<sad_decoded>& decoded_, uint32_t size_, size_t memory_words_) :
+            decoded(decoded_), size(size_), memory_words(memory_words_), block_start(0), block_length(0), fused(false) { }
+
+        // generates the whole program, with start as an extra block boundary for entering it
+        void generate(uint32_t start) {
+            assign_registers();
+            find_leaders(start);
+            offsets.assign(size + 1, 0);
+            prologue();
+            for (uint32_t pc = 0; pc < size; pc++) {
+                if (fused) {
+                    fused = false;
+                    continue;
+                }
+                offsets[pc] = x.position();
+                if (leader[pc] && !leaves(decoded[pc].handler)) {
+                    // the block is counted as a whole on entry, instructions left to step() count themselves
+                    block_start = pc;
+                    block_length = 1;
+                    while (pc + block_length < size && !leader[pc + block_length] && !leaves(decoded[pc + block_length].handler)) {
+                        block_length++;
+                    }
+                    x.op(0x81, 0, jit_field(offsetof(sad_jit_state, executed)), true); // add qword [rbx + executed], imm32
+                    x.word32(block_length);
+                }
+                translate(pc);
+            }
+            offsets[size] = x.position();
+            exit_to_vm(size, JIT_HALT);
+            size_t epilogue_at = x.position();
+            epilogue();
+            for (size_t i = 0; i < faults.size(); i++) {
+                x.link32(faults[i].at, x.position());
+                x.op(0x81, 5, jit_field(offsetof(sad_jit_state, executed)), true); // sub qword [rbx + executed], imm32
+                x.word32(faults[i].unexecuted);
+                exit_to_vm(faults[i].pc, faults[i].reason);
+            }
+            for (size_t i = 0; i < to_epilogue.size(); i++) x.link32(to_epilogue[i], epilogue_at);
+            for (size_t i = 0; i < jumps.size(); i++) x.link32(jumps[i].at, offsets[jumps[i].target]);
+        }
+
+        // copies the code into executable memory
+        bool install(sad_jit& jit) {
+            size_t page = 4096;
+            jit.capacity = (x.bytes.size() + page - 1) / page * page;
+            void* memory = mmap(NULL, jit.capacity, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (memory == MAP_FAILED) return false;
+            jit.code = (unsigned char*)memory;
+            memcpy(jit.code, x.bytes.data(), x.bytes.size());
+            if (mprotect(jit.code, jit.capacity, PROT_READ | PROT_EXEC) != 0) return false;
+            jit.entries.resize(size + 1);
+            for (uint32_t pc = 0; pc <= size; pc++) jit.entries[pc] = jit.code + offsets[pc];
+            jit.enter = (uint32_t (*)(sad_jit_state*, const void*))(void*)jit.code;
+            jit.memory_words = memory_words;
+            return true;
+        }
+};
+
+bool sad_vm::translate() {
+    if (decoded.empty()) decode();
+    if (jit && jit->memory_words == mem.size()) return true;
+    discard_jit();
+    // addresses are checked against a 32-bit immediate
+    if (mem.size() > 0x7fffffff || program.size() >= SAD_HALT) return false;
+    uint32_t size = program.size();
+    uint32_t start = regs[REG_PC];
+    jit_translator t(decoded, size, mem.size());
+    t.generate(start < size ? start : size);
+    jit = new sad_jit();
+    if (!t.install(*jit)) {
+        discard_jit();
+        return false;
+    }
+    return true;
+}
+
+bool sad_vm::run_jit() {
+    sad_jit_state state;
+    memcpy(state.regs, regs, sizeof(regs));
+    state.cond = cond;
+    state.ra = ra;
+    state.executed = 0;
+    state.entries = jit->entries.data();
+    state.memory = mem.data();
+    uint32_t size = program.size();
+    uint32_t pc = (uint32_t)regs[REG_PC] < size ? (uint32_t)regs[REG_PC] : size;
+    bool ok = true;
+    while (true) {
+        uint32_t reason = jit->enter(&state, jit->entries[pc]);
+        pc = state.exit_pc;
+        memcpy(regs, state.regs, sizeof(regs));
+        cond = state.cond;
+        ra = state.ra;
+        if (reason == JIT_HALT) break;
+        if (reason == JIT_BAD_ADDRESS) {
+            ok = fault("data memory address out of range", pc);
+            break;
+        }
+        if (reason == JIT_DIVISION_BY_ZERO) {
+            ok = fault("division by zero", pc);
+            break;
+        }
+        // the instruction was left to the interpreter
+        if (decoded[pc].handler == H_BAD) {
+            ok = unsupported(pc);
+            break;
+        }
+        regs[REG_PC] = pc + 1;
+        if (!step(program[pc], pc)) {
+            ok = false;
+            break;
+        }
+        state.executed++;
+        pc = (uint32_t)regs[REG_PC] < size ? (uint32_t)regs[REG_PC] : size;
+        memcpy(state.regs, regs, sizeof(regs));
+        state.cond = cond;
+        state.ra = ra;
+    }
+    executed = state.executed;
+    regs[REG_PC] = pc;
+    out.flush();
+    return ok;
+}
+
+#else
+
+bool sad_jit_available() { return false; }
+
+bool sad_vm::translate() { return false; }
+
+bool sad_vm::run_jit() { return false; }
+
+#endif
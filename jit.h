@@ -0,0 +1,33 @@
+/*
+jit.h
+Author: Kristopher J. Carroll
+Description:
+    Translation of whole SAD VM programs into x86-64 machine code, used by sad_vm::run() when the
+    machine is set to JIT (pascal --jit). The program is translated once, the first time it runs,
+    from the same pre-decoded form the interpreter executes, so both agree on what every
+    instruction means.
+
+    SAD registers are mapped onto the nine host registers the generated code has to spare (rsi, rdi
+    and r8 to r14), choosing the registers used most often with uses inside loops weighing more.
+    The rest live in a state block addressed from rbx. The cond register is kept in ebp, data memory
+    is addressed from r15, and eax, ecx and edx are scratch. A comparison followed directly by its
+    JMPC becomes a compare and a conditional jump.
+
+    The instructions the translation does not handle itself, which are the I/O ports, the stack
+    and anything reading or writing PC, leave the generated code. The interpreter steps over each
+    of them with sad_vm::step() and then reenters the generated code at the next instruction.
+    Faults leave the same way, with the address they happened at. The count of executed
+    instructions is kept per basic block and corrected when a block is left early, so it matches
+    the interpreter's.
+
+    Translation is only available on x86-64 systems with mmap and can be left out of the build
+    with JIT=off (SAD_VM_NO_JIT), in which case sad_vm::run() keeps using the interpreter.
+*/
+
+#ifndef JIT_H
+#define JIT_H
+
+// whether this build can translate programs to native code
+bool sad_jit_available();
+
+#endif
@@ -0,0 +1,46 @@
+/*
+libpascal.cpp
+Author: Kristopher J. Carroll
+Description:
+    Compiling and running programs through the library interface described in libpascal.h.
+*/
+
+#include "context.h"
+#include "libpascal.h"
+
+bool compile_pascal(const std::string& source, pascal_program& program, std::vector<std::string>& errors, bool optimize) {
+    source_buffer buffer;
+    if (!buffer.load(source.data(), source.size())) {
+        errors.push_back("could not read source");
+        return false;
+    }
+    compile_context context;
+    if (!context.parse(buffer)) {
+        errors = context.errors;
+        return false;
+    }
+    context.root->compile(optimize);
+    program.image = context.root->get_image();
+    program.removed = context.root->get_removed();
+    program.dead_stores = context.root->get_dead_stores();
+    return true;
+}
+
+pascal_vm::pascal_vm(const pascal_program& program, size_t memory_words, size_t stack_words) :
+    image(program.image),
+    vm(memory_words ? memory_words : image.data_base + image.data.size(), stack_words) {
+    vm.set_output(&text);
+    vm.load(image);
+}
+
+bool pascal_vm::run(const std::vector<int32_t>& inputs) {
+    text.clear();
+    vm.reset();
+    vm.load_data(image);
+    // an empty vector may have no data, which would mean stdin
+    static const int32_t none = 0;
+    vm.set_input(inputs.empty() ? &none : inputs.data(), inputs.size());
+    bool ok = vm.run();
+    vm.set_input(NULL, 0);
+    return ok;
+}
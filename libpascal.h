@@ -0,0 +1,75 @@
+/*
+libpascal.h
+Author: Kristopher J. Carroll
+Description:
+    The compiler and the native VM as a library for programs embedding them, built by make lib
+    into libpascal.a and libpascal.so alongside the pascal executable.
+
+        pascal_program program;
+        std::vector<std::string> errors;
+        if (!compile_pascal(source, program, errors)) ...
+        pascal_vm vm(program);
+        if (vm.run(inputs)) use(vm.output());
+
+    A program is compiled once and can then be run any number of times, by any number of machines.
+    A pascal_vm loads its program once, decoding it (and with JIT on translating it) only then, and
+    keeps its data memory, stack and output between runs, so each run only resets the registers,
+    rewrites data memory from the program and executes. Data memory is sized to the program's data
+    section by default, which is all compiled programs ever address, so resetting it is cheap.
+
+    Every run starts the program over from the same state, reading the input port from the values
+    it is given and collecting what the program writes to the output ports in output(). Runs fail
+    with the VM's error message on a fault, including reading past the last input value.
+
+    Compilations share nothing, so programs can be compiled on any number of threads at once. A
+    pascal_vm is used by one thread at a time, and separate machines run independently. Many
+    instances of one program over different inputs can also run in lockstep on a sad_batch_vm (see
+    batch_vm.h), which the library includes as well.
+*/
+
+#ifndef LIBPASCAL_H
+#define LIBPASCAL_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "SAD_VM.h"
+
+// a compiled program, ready to be run
+struct pascal_program {
+    sad_image image;
+    int removed; // instructions removed by the peephole optimizer
+    int dead_stores; // instructions removed by dead store elimination
+
+    pascal_program() : removed(0), dead_stores(0) { }
+};
+
+// compiles the program in source into program, running the optimizer unless told otherwise,
+// returning false and filling in errors if it does not compile
+bool compile_pascal(const std::string& source, pascal_program& program, std::vector<std::string>& errors,
+                    bool optimize = true);
+
+// a machine holding one program, run over from the start as many times as needed
+class pascal_vm {
+    protected:
+        sad_image image;
+        sad_vm vm;
+        std::string text; // output of the last run
+    public:
+        // memory_words of 0 sizes data memory to the program's data section
+        pascal_vm(const pascal_program& program, size_t memory_words = 0, size_t stack_words = SAD_STACK_WORDS);
+
+        // runs the program from its initial state with inputs for the input port, returning false if
+        // execution stopped on a fault
+        bool run(const std::vector<int32_t>& inputs = std::vector<int32_t>());
+        // everything the last run wrote to the output ports, up to the fault if it faulted
+        const std::string& output() const { return text; }
+        // why the last run failed
+        const std::string& error() const { return vm.error(); }
+        // number of instructions executed by the last run
+        uint64_t executed() const { return vm.executed; }
+        // runs the program translated to native code from the next run on, where this build supports it
+        void set_jit(bool on) { vm.set_jit(on); }
+};
+
+#endif
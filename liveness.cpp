@@ -0,0 +1,383 @@
+/*
+liveness.cpp
+Author: Kristopher J. Carroll
+Description:
+    Block liveness by iterative dataflow, dead store elimination and live ranges, see liveness.h.
+*/
+
+#include <stdint.h>
+#include <algorithm>
+#include "liveness.h"
+
+// op code marking an instruction removed, dropped when the buffer is compacted
+static const uint8_t DELETED = 0xff;
+
+// in liveness_analysis::global, a register live across blocks that is followed on its own
+static const int SPARSE = -2;
+
+struct basic_block {
+    int begin, end; // instruction indices, end is one past the last
+    int successors[2]; // -1 when unused
+    bool returns; // ends in a RET, which could go anywhere
+};
+
+class liveness_analysis {
+    protected:
+        std::vector<instruction>& insts;
+        std::vector<basic_block> blocks;
+        std::vector<int> global; // per virtual register, its bit in the block sets, SPARSE or -1
+        std::vector<int> vreg_of; // per bit, the virtual register it stands for
+        size_t words; // per block set
+        std::vector<uint64_t> used, written, live_in, live_out;
+        // (block, register) for the sparse registers, what blocks read first and write, then where
+        // they are live, live out sorted by block with the first entry of every block in out_first
+        std::vector<std::pair<int, int> > sparse_used, sparse_written, sparse_in, sparse_out;
+        std::vector<int> out_first;
+
+        uint64_t* set(std::vector<uint64_t>& sets, size_t block) { return &sets[block * words]; }
+        static void mark(uint64_t* bits, int bit) { bits[bit / 64] |= (uint64_t)1 << (bit % 64); }
+
+        // splits the code at labels and after branches, linking every block to where it can go next
+        void find_blocks(int labels) {
+            std::vector<int> label_block(labels, -1);
+            int n = insts.size();
+            for (int i = 0; i < n; ) {
+                basic_block b;
+                b.begin = i;
+                if (insts[i].op == IR_LABEL) label_block[insts[i].imm] = blocks.size();
+                do i++; while (i < n && insts[i].op != IR_LABEL && !ir_is_jump(insts[i - 1]) && insts[i - 1].op != OP_RET);
+                b.end = i;
+                blocks.push_back(b);
+            }
+            for (size_t k = 0; k < blocks.size(); k++) {
+                basic_block& b = blocks[k];
+                const instruction& last = insts[b.end - 1];
+                int next = k + 1 < blocks.size() ? (int)k + 1 : -1;
+                int target = ir_is_jump(last) && (uint32_t)last.imm != SAD_HALT ? label_block[last.imm] : -1;
+                b.returns = last.op == OP_RET;
+                b.successors[0] = last.op == OP_JMP || b.returns ? -1 : next;
+                b.successors[1] = target;
+            }
+        }
+
+        // gives a bit to every register some block reads before writing it, the only ones that can
+        // be live at the start of a block, and fills in what each block reads first and writes.
+        // Temporaries like that are values moved out of a loop and live only around it, so unless
+        // a RET makes everything live they are left SPARSE rather than taking a bit in every block
+        void find_globals(const std::vector<uint8_t>& variables) {
+            int vregs = variables.size();
+            bool returns = false;
+            for (size_t k = 0; k < blocks.size(); k++) returns = returns || blocks[k].returns;
+            global.assign(vregs, -1);
+            std::vector<int> defined(vregs, -1); // last block writing each register
+            int count = 0;
+            for (int pass = 0; pass < 2; pass++) {
+                if (pass == 1) {
+                    words = (count + 63) / 64;
+                    vreg_of.assign(words * 64, -1);
+                    for (int v = 0; v < vregs; v++) if (global[v] >= 0) vreg_of[global[v]] = v;
+                    used.assign(blocks.size() * words, 0);
+                    written.assign(blocks.size() * words, 0);
+                    std::fill(defined.begin(), defined.end(), -1);
+                }
+                for (size_t k = 0; k < blocks.size(); k++) {
+                    for (int i = blocks[k].begin; i < blocks[k].end; i++) {
+                        int* uses[2];
+                        int n = ir_uses(insts[i], uses);
+                        for (int u = 0; u < n; u++) {
+                            if (!ir_is_vreg(*uses[u])) continue;
+                            int v = *uses[u] - IR_VREG_BASE;
+                            if (defined[v] == (int)k) continue;
+                            if (pass == 0 && global[v] == -1) global[v] = variables[v] || returns ? count++ : SPARSE;
+                            if (pass == 1 && global[v] >= 0) mark(set(used, k), global[v]);
+                            if (pass == 1 && global[v] == SPARSE) sparse_used.push_back(std::make_pair(k, v));
+                        }
+                        int* def = ir_def(insts[i]);
+                        if (!def || !ir_is_vreg(*def)) continue;
+                        int v = *def - IR_VREG_BASE;
+                        defined[v] = k;
+                        if (pass == 1 && global[v] >= 0) mark(set(written, k), global[v]);
+                        if (pass == 1 && global[v] == SPARSE) sparse_written.push_back(std::make_pair(k, v));
+                    }
+                }
+            }
+        }
+
+        // iterates the dataflow equations to a fixed point, visiting blocks last to first so most
+        // values settle in the first pass
+        void solve() {
+            live_in.assign(blocks.size() * words, 0);
+            live_out.assign(blocks.size() * words, 0);
+            bool changed = true;
+            while (changed) {
+                changed = false;
+                for (size_t k = blocks.size(); k-- > 0;) {
+                    uint64_t* out = set(live_out, k);
+                    uint64_t* in = set(live_in, k);
+                    const uint64_t* use = set(used, k);
+                    const uint64_t* def = set(written, k);
+                    for (size_t w = 0; w < words; w++) {
+                        // a RET could return anywhere, so everything stays live past it
+                        uint64_t o = blocks[k].returns ? ~(uint64_t)0 : 0;
+                        for (int s = 0; s < 2; s++) {
+                            if (blocks[k].successors[s] >= 0) o |= set(live_in, blocks[k].successors[s])[w];
+                        }
+                        uint64_t i = use[w] | (o & ~def[w]);
+                        if (o != out[w] || i != in[w]) changed = true;
+                        out[w] = o;
+                        in[w] = i;
+                    }
+                }
+            }
+        }
+
+        // follows each sparse register back from the blocks reading it before writing it, through
+        // predecessors until reaching blocks that write it
+        void solve_sparse(int vregs) {
+            out_first.assign(blocks.size() + 1, 0);
+            if (sparse_used.empty()) return;
+            std::vector<int> pred_first(blocks.size() + 1, 0), preds;
+            for (size_t k = 0; k < blocks.size(); k++) {
+                for (int s = 0; s < 2; s++) if (blocks[k].successors[s] >= 0) pred_first[blocks[k].successors[s] + 1]++;
+            }
+            for (size_t k = 0; k < blocks.size(); k++) pred_first[k + 1] += pred_first[k];
+            preds.resize(pred_first.back());
+            std::vector<int> fill(pred_first.begin(), pred_first.end() - 1);
+            for (size_t k = 0; k < blocks.size(); k++) {
+                for (int s = 0; s < 2; s++) if (blocks[k].successors[s] >= 0) preds[fill[blocks[k].successors[s]]++] = k;
+            }
+
+            // grouped by register, in block order within each
+            std::vector<std::pair<int, int> > by_vreg[2];
+            std::vector<int> first[2];
+            std::vector<std::pair<int, int> >* lists[2] = { &sparse_used, &sparse_written };
+            for (int l = 0; l < 2; l++) {
+                first[l].assign(vregs + 1, 0);
+                for (size_t e = 0; e < lists[l]->size(); e++) first[l][(*lists[l])[e].second + 1]++;
+                for (int v = 0; v < vregs; v++) first[l][v + 1] += first[l][v];
+                by_vreg[l].resize(lists[l]->size());
+                std::vector<int> at(first[l].begin(), first[l].end() - 1);
+                for (size_t e = 0; e < lists[l]->size(); e++) by_vreg[l][at[(*lists[l])[e].second]++] = (*lists[l])[e];
+            }
+
+            std::vector<int> writes(blocks.size(), -1), in(blocks.size(), -1), out(blocks.size(), -1), work;
+            for (int v = 0; v < vregs; v++) {
+                if (global[v] != SPARSE) continue;
+                for (int e = first[1][v]; e < first[1][v + 1]; e++) writes[by_vreg[1][e].first] = v;
+                for (int e = first[0][v]; e < first[0][v + 1]; e++) {
+                    int k = by_vreg[0][e].first;
+                    in[k] = v;
+                    sparse_in.push_back(std::make_pair(k, v));
+                    work.push_back(k);
+                }
+                while (!work.empty()) {
+                    int k = work.back();
+                    work.pop_back();
+                    for (int p = pred_first[k]; p < pred_first[k + 1]; p++) {
+                        int b = preds[p];
+                        if (out[b] != v) out[b] = v, sparse_out.push_back(std::make_pair(b, v));
+                        if (writes[b] != v && in[b] != v) in[b] = v, sparse_in.push_back(std::make_pair(b, v)), work.push_back(b);
+                    }
+                }
+            }
+            std::sort(sparse_out.begin(), sparse_out.end());
+            for (size_t e = 0; e < sparse_out.size(); e++) out_first[sparse_out[e].first + 1]++;
+            for (size_t k = 0; k < blocks.size(); k++) out_first[k + 1] += out_first[k];
+        }
+
+    public:
+        liveness_analysis(code_buffer& code) : insts(code.code), words(0) {
+            find_blocks(code.labels());
+            find_globals(code.variables);
+            solve();
+            solve_sparse(code.vregs());
+        }
+
+        // deletes instructions writing a register that is dead right after them, going backwards
+        // through each block from what is live out of it so a dead value's operands can die too,
+        // setting again when a deleted instruction read a register live into its block, which may
+        // now be dead in the blocks before
+        int remove_dead(int vregs, bool& again) {
+            std::vector<uint8_t> live(vregs, 0);
+            std::vector<int> touched;
+            int removed = 0;
+            for (size_t k = 0; k < blocks.size(); k++) {
+                for (size_t w = 0; w < words; w++) {
+                    for (uint64_t bits = set(live_out, k)[w]; bits; bits &= bits - 1) {
+                        int v = vreg_of[w * 64 + __builtin_ctzll(bits)];
+                        if (v >= 0) {
+                            live[v] = 1;
+                            touched.push_back(v);
+                        }
+                    }
+                }
+                for (int e = out_first[k]; e < out_first[k + 1]; e++) {
+                    live[sparse_out[e].second] = 1;
+                    touched.push_back(sparse_out[e].second);
+                }
+                for (int i = blocks[k].end; i-- > blocks[k].begin;) {
+                    instruction& inst = insts[i];
+                    int* def = ir_def(inst);
+                    if (def && ir_is_vreg(*def)) {
+                        int v = *def - IR_VREG_BASE;
+                        if (!live[v] && ir_removable(inst)) {
+                            int* uses[2];
+                            int n = ir_uses(inst, uses);
+                            for (int u = 0; u < n; u++) {
+                                if (ir_is_vreg(*uses[u]) && global[*uses[u] - IR_VREG_BASE] != -1) again = true;
+                            }
+                            inst.op = DELETED;
+                            removed++;
+                            continue;
+                        }
+                        live[v] = 0;
+                    }
+                    int* uses[2];
+                    int n = ir_uses(inst, uses);
+                    for (int u = 0; u < n; u++) {
+                        if (!ir_is_vreg(*uses[u])) continue;
+                        live[*uses[u] - IR_VREG_BASE] = 1;
+                        touched.push_back(*uses[u] - IR_VREG_BASE);
+                    }
+                }
+                for (size_t t = 0; t < touched.size(); t++) live[touched[t]] = 0;
+                touched.clear();
+            }
+            return removed;
+        }
+
+        // a register is live from the start of every block it is live into to the end of every
+        // block it is live out of, and at every instruction referencing it, so the span between the
+        // first and last of those covers everywhere its value is needed
+        void ranges(int vregs, std::vector<live_range>& out) {
+            live_range none = { INT32_MAX, -1 };
+            out.assign(vregs, none);
+            for (size_t i = 0; i < insts.size(); i++) {
+                int* operands[3];
+                int n = ir_uses(insts[i], operands);
+                if (int* def = ir_def(insts[i])) operands[n++] = def;
+                for (int o = 0; o < n; o++) {
+                    if (!ir_is_vreg(*operands[o])) continue;
+                    live_range& r = out[*operands[o] - IR_VREG_BASE];
+                    r.start = std::min(r.start, (int)i);
+                    r.end = std::max(r.end, (int)i);
+                }
+            }
+            for (size_t k = 0; k < blocks.size(); k++) {
+                for (size_t w = 0; w < words; w++) {
+                    for (uint64_t bits = set(live_in, k)[w]; bits; bits &= bits - 1) {
+                        int v = vreg_of[w * 64 + __builtin_ctzll(bits)];
+                        if (v < 0) continue;
+                        out[v].start = std::min(out[v].start, blocks[k].begin);
+                        out[v].end = std::max(out[v].end, blocks[k].begin);
+                    }
+                    for (uint64_t bits = set(live_out, k)[w]; bits; bits &= bits - 1) {
+                        int v = vreg_of[w * 64 + __builtin_ctzll(bits)];
+                        if (v < 0) continue;
+                        out[v].start = std::min(out[v].start, blocks[k].end - 1);
+                        out[v].end = std::max(out[v].end, blocks[k].end - 1);
+                    }
+                }
+            }
+            for (size_t e = 0; e < sparse_in.size(); e++) {
+                live_range& r = out[sparse_in[e].second];
+                r.start = std::min(r.start, blocks[sparse_in[e].first].begin);
+                r.end = std::max(r.end, blocks[sparse_in[e].first].begin);
+            }
+            for (size_t e = 0; e < sparse_out.size(); e++) {
+                live_range& r = out[sparse_out[e].second];
+                r.start = std::min(r.start, blocks[sparse_out[e].first].end - 1);
+                r.end = std::max(r.end, blocks[sparse_out[e].first].end - 1);
+            }
+        }
+};
+
+// drops deleted instructions
+static void compact(code_buffer& code) {
+    size_t out = 0;
+    for (size_t i = 0; i < code.code.size(); i++) {
+        if (code.code[i].op != DELETED) code.code[out++] = code.code[i];
+    }
+    code.code.resize(out);
+}
+
+// deletes every instruction computing a register whose value can never reach anything the program
+// does, like a sum that is updated in a loop but never printed, which stays live around the loop
+// since each update reads the one before it. Instructions that cannot be removed are what the
+// program does, the registers they read are needed, and so are the registers read by anything
+// writing a needed register.
+static int remove_useless(code_buffer& code) {
+    std::vector<instruction>& insts = code.code;
+    int vregs = code.vregs();
+    // the instructions writing each register, grouped by register
+    std::vector<int> first(vregs + 1, 0), writers(insts.size());
+    for (size_t i = 0; i < insts.size(); i++) {
+        int* def = ir_def(insts[i]);
+        if (def && ir_is_vreg(*def)) first[*def - IR_VREG_BASE + 1]++;
+    }
+    for (int v = 0; v < vregs; v++) first[v + 1] += first[v];
+    std::vector<int> fill(first.begin(), first.end() - 1);
+    for (size_t i = 0; i < insts.size(); i++) {
+        int* def = ir_def(insts[i]);
+        if (def && ir_is_vreg(*def)) writers[fill[*def - IR_VREG_BASE]++] = i;
+    }
+
+    std::vector<uint8_t> needed(vregs, 0);
+    std::vector<int> work;
+    for (size_t i = 0; i < insts.size(); i++) {
+        int* def = ir_def(insts[i]);
+        if (def && ir_is_vreg(*def) && ir_removable(insts[i])) continue;
+        int* uses[2];
+        int n = ir_uses(insts[i], uses);
+        for (int u = 0; u < n; u++) {
+            int v = *uses[u] - IR_VREG_BASE;
+            if (v >= 0 && !needed[v]) needed[v] = 1, work.push_back(v);
+        }
+    }
+    while (!work.empty()) {
+        int v = work.back();
+        work.pop_back();
+        for (int w = first[v]; w < first[v + 1]; w++) {
+            int* uses[2];
+            int n = ir_uses(insts[writers[w]], uses);
+            for (int u = 0; u < n; u++) {
+                int used = *uses[u] - IR_VREG_BASE;
+                if (used >= 0 && !needed[used]) needed[used] = 1, work.push_back(used);
+            }
+        }
+    }
+
+    int removed = 0;
+    for (size_t i = 0; i < insts.size(); i++) {
+        int* def = ir_def(insts[i]);
+        if (def && ir_is_vreg(*def) && !needed[*def - IR_VREG_BASE] && ir_removable(insts[i])) {
+            insts[i].op = DELETED;
+            removed++;
+        }
+    }
+    compact(code);
+    return removed;
+}
+
+int eliminate_dead_stores(code_buffer& code) {
+    int removed = remove_useless(code);
+    bool again = true;
+    for (int round = 0; again && round < 8 && !code.code.empty(); round++) {
+        again = false;
+        liveness_analysis analysis(code);
+        int dead = analysis.remove_dead(code.vregs(), again);
+        if (!dead) break;
+        compact(code);
+        removed += dead;
+    }
+    return removed;
+}
+
+void live_ranges(code_buffer& code, std::vector<live_range>& ranges) {
+    if (code.code.empty()) {
+        ranges.assign(code.vregs(), live_range{ INT32_MAX, -1 });
+        return;
+    }
+    liveness_analysis analysis(code);
+    analysis.ranges(code.vregs(), ranges);
+}
@@ -0,0 +1,51 @@
+/*
+liveness.h
+Author: Kristopher J. Carroll
+Description:
+    Liveness analysis of the instruction buffer on virtual registers, run between the peephole
+    optimizer and register allocation. The code is split into basic blocks at labels and after
+    branches, and the virtual registers live into and out of every block are found by iterating the
+    backward dataflow equations
+
+        live out(b) = union of live in(s) over the successors s of b
+        live in(b) = used in b before being written there, plus live out(b) less what b writes
+
+    until nothing changes, so values carried around loops and into either arm of an IF are followed
+    along the paths they actually take.
+
+    Only registers read in some block before that block writes them can be live across a block
+    boundary, so the sets only hold those. Temporaries, nearly all of the virtual registers, rarely
+    are, which keeps the sets to a word or two per block even for very large programs. The few that
+    are, values moved out of a loop and live only around it, are followed one at a time from the
+    blocks reading them back to the blocks writing them instead of taking a bit in every block.
+
+    Two things come out of it:
+        - instructions whose result no path ever reads are removed, repeating until none are left
+          so a chain of dead values goes at once. Before that, values that only ever feed their
+          own updates, like a total kept in a loop but never printed, are removed as a whole, since
+          such a value stays live around the loop. Variables that are never read are left with no
+          code and no register at all
+        - the register allocator gets, for every virtual register, the span of instructions from
+          the first to the last point where it holds a value something still needs, instead of
+          keeping every variable referenced in a loop alive for the whole loop
+*/
+
+#ifndef LIVENESS_H
+#define LIVENESS_H
+
+#include <vector>
+#include "IR.h"
+
+// first and last instruction index at which a virtual register holds a value, end is -1 for
+// registers the code never mentions
+struct live_range {
+    int start, end;
+};
+
+// removes instructions whose result is dead on every path, returning how many were removed
+int eliminate_dead_stores(code_buffer& code);
+
+// computes the live range of every virtual register in code
+void live_ranges(code_buffer& code, std::vector<live_range>& ranges);
+
+#endif
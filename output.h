@@ -0,0 +1,71 @@
+/*
+output.h
+Author: Kristopher J. Carroll
+Description:
+    Buffered writer for program output (WRITELN and the VM's output ports). Integers are formatted by
+    hand into a fixed buffer that is handed to the underlying FILE in large chunks, so programs
+    writing a value per loop iteration are not slowed down by a flush or stream formatting per line.
+    Anything printed to the same FILE through other means should only happen after flush(). Output
+    can also be collected in a string instead, for programs run through the library (see libpascal.h).
+*/
+
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+
+class output_buffer {
+    protected:
+        static const size_t SIZE = 64 * 1024;
+        FILE* file;
+        std::string* text; // receiving the output instead of file when set
+        size_t used;
+        char buffer[SIZE];
+    public:
+        output_buffer(FILE* file_ = stdout) : file(file_), text(NULL), used(0) { }
+        ~output_buffer() { flush(); }
+
+        // writes a value followed by a newline, matching print() in SAD_VM.py
+        void write_int(int32_t value) {
+            if (used + 12 > SIZE) flush();
+            char digits[10];
+            int count = 0;
+            uint32_t magnitude = value < 0 ? 0u - (uint32_t)value : (uint32_t)value;
+            do {
+                digits[count++] = '0' + magnitude % 10;
+                magnitude /= 10;
+            } while (magnitude);
+            if (value < 0) buffer[used++] = '-';
+            while (count) buffer[used++] = digits[--count];
+            buffer[used++] = '\n';
+        }
+        void write_char(char c) {
+            if (used == SIZE) flush();
+            buffer[used++] = c;
+        }
+        // flushes what was written so far and continues on another FILE
+        void set_file(FILE* file_) {
+            flush();
+            file = file_;
+            text = NULL;
+        }
+        // flushes what was written so far and appends everything after it to text_
+        void set_string(std::string* text_) {
+            flush();
+            text = text_;
+        }
+        void flush() {
+            if (text) {
+                text->append(buffer, used);
+                used = 0;
+                return;
+            }
+            if (used) fwrite(buffer, 1, used, file);
+            used = 0;
+            fflush(file);
+        }
+};
+
+#endif
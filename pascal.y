@@ -5,6 +5,11 @@
           YACC/Bison file for parsing input code from a small subset of the Pascal programming language.
           As the YACC format is generally well documented and fairly simple to follow, very little explanation
           will be provided.
+
+          The parser is pure and takes the compilation context (see context.h) and the reentrant scanner
+          from pascal.l as parameters, so nothing about a parse is kept in globals. Token locations carry
+          the source line for error messages, and identifiers arrive as spans of the source text which are
+          only interned when a variable is declared.
     */
     // include code needed at the beginning here
     #include <iostream>
@@ -12,31 +17,39 @@
     #include <map>
     #include <string>
     #include "AST.h"
+    #include "context.h"
+    #include "SAD_VM.h"
     #include "parser.h"
-    std::map<std::string, var_node*> symbols;
-    void insert_symbol(std::string symbol);
-    var_node* lookup_symbol(std::string symbol);
-    program* root;
-    int yyerror(const char* s);
-    int yylex();
-    int line_num = 0;
-
-    std::list<std::string> regs = {"R_0", "R_1", "R_2", "R_3", "R_4", "R_5", "R_6", 
-                                   "R_7", "R_8", "R_9", "R_10", "R_11", "R_12", "R_13"}; 
+    // reentrant scanner interface generated from pascal.l
+    typedef void* yyscan_t;
+    int yylex(YYSTYPE* yylval_param, YYLTYPE* yylloc_param, yyscan_t yyscanner);
+    int yylex_init_extra(compile_context* context, yyscan_t* scanner);
+    struct yy_buffer_state* yy_scan_buffer(char* base, size_t size, yyscan_t scanner);
+    int yylex_destroy(yyscan_t scanner);
+    int yyerror(YYLTYPE* location, compile_context* context, void* scanner, const char* s);
 
 %}
+%code requires {
+    #include "source.h"
+    class compile_context;
+}
+%define api.pure full
+%locations
+%parse-param { compile_context* context } { void* scanner }
+%lex-param { void* scanner }
+
 // Type union for YYLVAL
 %union {
-    char* id;
+    source_span span; // identifier text in the source buffer
     int num;
     std::vector<const char*> *id_list;
     expression_node* expr_node;
-    std::vector<statement*> *statement_list;
-    statement* statement;
-    program* program;
+    statement_vector *statement_list;
+    statement* stmt;
+    program* prog;
 }
 %token <num> NUM
-%token <id> ID
+%token <span> ID
 %token PROGRAM BEG END PERIOD ASSIGN SEMI
 %token VAR COLON INTEGER
 %token IF THEN ELSE WHILE DO
@@ -55,13 +68,13 @@
 // further types for nonterminals from AST.h
 %type <id_list> id_list
 %type <statement_list> statement_list block
-%type <statement> statement
-%type <program> program
+%type <stmt> statement
+%type <prog> program
 
 
 
 %%
-program: PROGRAM ID SEMI decl block PERIOD { $$ = new program($5); root = $$; }
+program: PROGRAM ID SEMI decl block PERIOD { $$ = new program($5, context->symbols.size(), context->pool); context->root = $$; }
 ;
 
 
@@ -69,89 +82,115 @@ decl: VAR id_list COLON INTEGER SEMI
 ;
 
 
-id_list: ID { insert_symbol($1); } 
-       | id_list ',' ID { insert_symbol($3); }
+id_list: ID { if (!context->declare($1, @1.first_line)) YYABORT; }
+       | id_list ',' ID { if (!context->declare($3, @3.first_line)) YYABORT; }
 ;
 
+// statements are all placed in a list through these rules, which is where they learn their source line
 block: BEG statement_list END { $$ = $2; }
-     | statement {$$ = new std::vector<statement*>(); $$->push_back($1); }
+     | statement { $1->set_line(@1.first_line); $$ = context->new_statement_vector(); $$->push_back($1); }
 ;
 
-statement_list: statement_list SEMI statement { $1->push_back($3); $$ = $1; }   
-              | statement { $$ = new std::vector<statement*>(); $$->push_back($1); } 
+statement_list: statement_list SEMI statement { $3->set_line(@3.first_line); $1->push_back($3); $$ = $1; }   
+              | statement { $1->set_line(@1.first_line); $$ = context->new_statement_vector(); $$->push_back($1); } 
               
 ;
 
-statement: ID ASSIGN expression { $$ = new assign_statement(lookup_symbol($1), $3); }
-         | IF expression THEN block %prec IFX { $$ = new if_statement($2, $4); }
-         | IF expression THEN block ELSE block { $$ = new if_else_statement($2, $4, $6); }
-         | WHILE expression DO block { $$ = new while_statement($2, $4); }
-         | WRITELN expression { $$ = new write_statement($2); }
+statement: ID ASSIGN expression {
+               var_node* var = context->lookup($1, @1.first_line);
+               if (!var) YYABORT;
+               $$ = new (context->pool) assign_statement(var, $3);
+           }
+         | IF expression THEN block %prec IFX { $$ = new (context->pool) if_statement($2, $4); }
+         | IF expression THEN block ELSE block { $$ = new (context->pool) if_else_statement($2, $4, $6); }
+         | WHILE expression DO block { $$ = new (context->pool) while_statement($2, $4); }
+         | WRITELN expression { $$ = new (context->pool) write_statement($2); }
 ;
 
-expression: expression GT additive_expression  { $$ = new gt_node($1, $3); }
-          | expression LT additive_expression  { $$ = new lt_node($1, $3); }
-          | expression GTE additive_expression { $$ = new gte_node($1, $3); }
-          | expression LTE additive_expression { $$ = new lte_node($1, $3); }
+expression: expression GT additive_expression  { $$ = new (context->pool) gt_node($1, $3); }
+          | expression LT additive_expression  { $$ = new (context->pool) lt_node($1, $3); }
+          | expression GTE additive_expression { $$ = new (context->pool) gte_node($1, $3); }
+          | expression LTE additive_expression { $$ = new (context->pool) lte_node($1, $3); }
           | additive_expression { $$ = $1; }
 ;
 
-additive_expression: additive_expression ADD multiplicative_expression { $$ = new add_node($1, $3); }
-                   | additive_expression SUB multiplicative_expression { $$ = new sub_node($1, $3); }
+additive_expression: additive_expression ADD multiplicative_expression { $$ = new (context->pool) add_node($1, $3); }
+                   | additive_expression SUB multiplicative_expression { $$ = new (context->pool) sub_node($1, $3); }
                    | multiplicative_expression { $$ = $1; }
 ;
 
-multiplicative_expression: multiplicative_expression MULT unary_expression { $$ = new mult_node($1, $3); }
-                         | multiplicative_expression DIV unary_expression { $$ = new div_node($1, $3); }
+multiplicative_expression: multiplicative_expression MULT unary_expression { $$ = new (context->pool) mult_node($1, $3); }
+                         | multiplicative_expression DIV unary_expression { $$ = new (context->pool) div_node($1, $3); }
                          | unary_expression { $$ = $1; }
 ;
 
-unary_expression: SUB unary_expression %prec UMINUS { $$ = new num_node(-($2->evaluate())); }
+unary_expression: SUB unary_expression %prec UMINUS { $$ = new (context->pool) sub_node(new (context->pool) num_node(0), $2); }
                 | primary_expression { $$ = $1; }
 ;
 
-primary_expression: ID { $$ = lookup_symbol($1); } 
-                  | NUM { $$ = new num_node($1); }
+primary_expression: ID { $$ = context->lookup($1, @1.first_line); if (!$$) YYABORT; }
+                  | NUM { $$ = new (context->pool) num_node($1); }
                   | '(' expression ')' { $$ = $2; }
 ;
 
 %%
 
-int main() {
-    yyparse();
-    root->evaluate();
-    root->compile();
-}
-
-int yyerror(const char* s) {
-    printf("Error during parse: %s\n", s);
+int yyerror(YYLTYPE* location, compile_context* context, void* scanner, const char* s) {
+    context->error(s, location->first_line);
     return 1;
 }
 
-// helper function for inserting symbols into the symbol map
-// will report an error if the same symbol is attempted to be declared twice
-void insert_symbol(std::string symbol) {
-    if (symbols.find(symbol) == symbols.end()) {
-        symbols[symbol] = new var_node(symbol);
+// scans an already loaded source to the end, returning the number of tokens or -1 on failure
+static long scan_tokens(compile_context* context, source_buffer& source) {
+    yyscan_t scanner;
+    if (yylex_init_extra(context, &scanner)) return -1;
+    long tokens = -1;
+    if (yy_scan_buffer(source.scan_base(), source.scan_size(), scanner)) {
+        YYSTYPE value;
+        YYLTYPE location;
+        for (tokens = 0; yylex(&value, &location, scanner); tokens++) { }
     }
-    else {
-        std::string error_msg = "symbol previously declared: ";
-        error_msg = error_msg + symbol;
-        yyerror(&error_msg[0]);
-        exit(-1);
+    yylex_destroy(scanner);
+    return tokens;
+}
+
+// runs the pure parser over in with a scanner of its own, scanning the source where it lies in memory
+bool compile_context::parse(FILE* in) {
+    source_buffer source;
+    pass_begin(timer, "read source");
+    if (!source.load(in)) {
+        pass_end(timer);
+        error("could not read source", 0);
+        return false;
     }
+    return parse(source);
 }
 
-// helper function for looking up a symbol in the symbol table
-// will report an error if a symbol not previously declared is attempted to be used
-var_node* lookup_symbol(std::string symbol) {
-    if (symbols.find(symbol) != symbols.end()) {
-        return symbols[symbol];
+bool compile_context::parse(source_buffer& source) {
+    if (timer) {
+        // scanning on its own first, the scanner leaves the buffer as it found it, and the line
+        // count starts over for the parse
+        timer->begin("lex");
+        scan_tokens(this, source);
+        line = 1;
+        timer->begin("parse");
     }
-    else {
-        std::string error_msg = "symbol not previously declared: ";
-        error_msg = error_msg + symbol;
-        yyerror(&error_msg[0]);
-        exit(-1);
+    yyscan_t scanner;
+    if (yylex_init_extra(this, &scanner)) {
+        pass_end(timer);
+        error("could not create scanner", 0);
+        return false;
     }
-}
\ No newline at end of file
+    int result = 1;
+    if (yy_scan_buffer(source.scan_base(), source.scan_size(), scanner)) result = yyparse(this, scanner);
+    else error("could not create scanner buffer", 0);
+    yylex_destroy(scanner);
+    pass_end(timer);
+    return result == 0 && root && errors.empty();
+}
+
+long compile_context::scan(FILE* in) {
+    source_buffer source;
+    if (!source.load(in)) return -1;
+    return scan_tokens(this, source);
+}
@@ -0,0 +1,354 @@
+/*
+peephole.cpp
+Author: Kristopher J. Carroll
+Description:
+    Peephole passes run before and after register allocation, see peephole.h.
+*/
+
+#include <utility>
+#include <vector>
+#include "peephole.h"
+#include "regalloc.h"
+
+// op code marking an instruction removed by a pass, dropped when the buffer is compacted
+static const uint8_t DELETED = 0xff;
+
+static bool is_branch(const instruction& i) {
+    return ir_is_jump(i) || i.op == OP_RET;
+}
+
+// drops deleted instructions, returning how many there were
+static int compact(code_buffer& code) {
+    size_t out = 0;
+    for (size_t i = 0; i < code.code.size(); i++) {
+        if (code.code[i].op != DELETED) code.code[out++] = code.code[i];
+    }
+    int removed = code.code.size() - out;
+    code.code.resize(out);
+    return removed;
+}
+
+// counts the reads and writes of every virtual register
+static void count_references(code_buffer& code, std::vector<int>& uses, std::vector<int>& defs) {
+    uses.assign(code.vregs(), 0);
+    defs.assign(code.vregs(), 0);
+    for (size_t i = 0; i < code.code.size(); i++) {
+        int* operands[2];
+        int count = ir_uses(code.code[i], operands);
+        for (int u = 0; u < count; u++) {
+            if (ir_is_vreg(*operands[u])) uses[*operands[u] - IR_VREG_BASE]++;
+        }
+        int* def = ir_def(code.code[i]);
+        if (def && ir_is_vreg(*def)) defs[*def - IR_VREG_BASE]++;
+    }
+}
+
+// t := ...; MOV x, t  ->  x := ...  when t is a temporary used by nothing else, as long as t is not
+// also read by the instruction writing it
+static bool coalesce_copies(code_buffer& code, std::vector<int>& uses, std::vector<int>& defs) {
+    bool changed = false;
+    std::vector<instruction>& insts = code.code;
+    for (size_t i = 1; i < insts.size(); i++) {
+        instruction& mov = insts[i];
+        if (mov.op != OP_MOV) continue;
+        if (mov.a == mov.b) {
+            mov.op = DELETED;
+            changed = true;
+            continue;
+        }
+        int t = mov.b - IR_VREG_BASE;
+        if (t < 0 || code.variables[t] || uses[t] != 1 || defs[t] != 1) continue;
+        instruction& prev = insts[i - 1];
+        int* def = ir_def(prev);
+        if (!def || *def != mov.b || prev.op == OP_MATHI || prev.op == OP_INC || prev.op == OP_DEC) continue;
+        *def = mov.a;
+        mov.op = DELETED;
+        uses[t] = defs[t] = 0;
+        changed = true;
+    }
+    return changed;
+}
+
+// LIMM t, c; MATH x, x, t  ->  MATHI x, c  when t is a temporary used by nothing else
+static bool fold_constant_operands(code_buffer& code, std::vector<int>& uses, std::vector<int>& defs) {
+    bool changed = false;
+    std::vector<instruction>& insts = code.code;
+    std::vector<int> constant(code.vregs(), -1); // index of the LIMM defining each single use temporary
+    for (size_t i = 0; i < insts.size(); i++) {
+        instruction& inst = insts[i];
+        if (inst.op == OP_LIMM && ir_is_vreg(inst.a)) {
+            int t = inst.a - IR_VREG_BASE;
+            if (!code.variables[t] && uses[t] == 1 && defs[t] == 1) constant[t] = i;
+            continue;
+        }
+        if (inst.op != OP_MATH) continue;
+        int operand = -1;
+        if (inst.a == inst.b && ir_is_vreg(inst.c)) operand = inst.c;
+        else if (inst.a == inst.c && ir_is_vreg(inst.b) && (inst.mode == MATH_ADD || inst.mode == MATH_MULT)) operand = inst.b;
+        if (operand < 0 || constant[operand - IR_VREG_BASE] < 0) continue;
+        instruction& limm = insts[constant[operand - IR_VREG_BASE]];
+        if (limm.imm < SAD_MATHI_MIN || limm.imm > SAD_MATHI_MAX || (inst.mode == MATH_DIV && limm.imm == 0)) continue;
+        inst = ir_at(ir_immediate(inst.a, inst.mode, limm.imm), inst.line);
+        limm.op = DELETED;
+        constant[operand - IR_VREG_BASE] = -1;
+        changed = true;
+    }
+    return changed;
+}
+
+// drops temporaries nobody reads and variable writes overwritten before they are read
+static bool remove_dead_defs(code_buffer& code, std::vector<int>& uses) {
+    bool changed = false;
+    std::vector<instruction>& insts = code.code;
+    std::vector<int> pending(code.vregs(), -1); // unread write of each variable in the current block
+    std::vector<int> written; // variables with a pending write
+    for (size_t i = 0; i < insts.size(); i++) {
+        instruction& inst = insts[i];
+        if (inst.op == DELETED) continue;
+        if (inst.op == IR_LABEL || is_branch(inst)) {
+            for (size_t w = 0; w < written.size(); w++) pending[written[w]] = -1;
+            written.clear();
+            continue;
+        }
+        int* operands[2];
+        int count = ir_uses(inst, operands);
+        for (int u = 0; u < count; u++) {
+            if (ir_is_vreg(*operands[u])) pending[*operands[u] - IR_VREG_BASE] = -1;
+        }
+        int* def = ir_def(inst);
+        if (!def || !ir_is_vreg(*def)) continue;
+        int v = *def - IR_VREG_BASE;
+        if (!code.variables[v]) {
+            if (uses[v] == 0 && ir_removable(inst)) {
+                inst.op = DELETED;
+                changed = true;
+            }
+            continue;
+        }
+        if (pending[v] >= 0) {
+            insts[pending[v]].op = DELETED;
+            changed = true;
+        }
+        pending[v] = ir_removable(inst) ? (int)i : -1;
+        written.push_back(v);
+    }
+    return changed;
+}
+
+// first instruction at or after index that is not a label or deleted
+static size_t next_instruction(const std::vector<instruction>& insts, size_t index) {
+    while (index < insts.size() && (insts[index].op == IR_LABEL || insts[index].op == DELETED)) index++;
+    return index;
+}
+
+// retargets jump chains, then removes jumps to the next instruction, unreachable code and
+// comparisons whose result is never read
+static bool thread_jumps(code_buffer& code) {
+    bool changed = false;
+    std::vector<instruction>& insts = code.code;
+    std::vector<size_t> position(code.labels(), insts.size());
+    for (size_t i = 0; i < insts.size(); i++) {
+        if (insts[i].op == IR_LABEL) position[insts[i].imm] = i;
+    }
+
+    for (size_t i = 0; i < insts.size(); i++) {
+        instruction& jump = insts[i];
+        if ((jump.op != OP_JMP && jump.op != OP_JMPC) || (uint32_t)jump.imm == SAD_HALT) continue;
+        // following the chain while it keeps going forward, or ends in a halt
+        int32_t target = jump.imm;
+        for (int hops = 0; hops < 16; hops++) {
+            size_t at = next_instruction(insts, position[target]);
+            if (at == insts.size() || insts[at].op != OP_JMP) break;
+            if ((uint32_t)insts[at].imm == SAD_HALT) {
+                target = SAD_HALT;
+                break;
+            }
+            if (position[insts[at].imm] <= i || insts[at].imm == target) break;
+            target = insts[at].imm;
+        }
+        if (target != jump.imm) {
+            jump.imm = target;
+            changed = true;
+        }
+        if ((uint32_t)jump.imm != SAD_HALT && position[jump.imm] > i &&
+            next_instruction(insts, i + 1) == next_instruction(insts, position[jump.imm])) {
+            jump.op = DELETED;
+            changed = true;
+        }
+    }
+
+    for (size_t i = 0; i < insts.size(); i++) {
+        if (insts[i].op == OP_JMP) {
+            // nothing can reach the code between an unconditional jump and the next label
+            for (size_t j = i + 1; j < insts.size() && insts[j].op != IR_LABEL; j++) {
+                if (insts[j].op != DELETED) {
+                    insts[j].op = DELETED;
+                    changed = true;
+                }
+            }
+        }
+        else if (insts[i].op == OP_COMP) {
+            // the condition is only read by a JMPC before the control flow goes anywhere else
+            size_t j = i + 1;
+            while (j < insts.size() && insts[j].op != OP_JMPC && insts[j].op != OP_COMP &&
+                   insts[j].op != IR_LABEL && !is_branch(insts[j])) j++;
+            if (j == insts.size() || insts[j].op == OP_COMP) {
+                insts[i].op = DELETED;
+                changed = true;
+            }
+        }
+    }
+    return changed;
+}
+
+int peephole_virtual(code_buffer& code) {
+    int removed = 0;
+    std::vector<int> uses, defs;
+    bool changed = true;
+    for (int round = 0; changed && round < 8; round++) {
+        changed = thread_jumps(code);
+        count_references(code, uses, defs);
+        changed |= coalesce_copies(code, uses, defs);
+        changed |= fold_constant_operands(code, uses, defs);
+        removed += compact(code);
+        count_references(code, uses, defs);
+        changed |= remove_dead_defs(code, uses);
+        removed += compact(code);
+    }
+    return removed;
+}
+
+// what is known about the registers and memory words within straight-line code
+class machine_state {
+    protected:
+        bool known[16];
+        int32_t value[16]; // constant held by each register, when known
+        std::vector<std::pair<int32_t, int> > cells; // memory words whose value is also in a register
+    public:
+        machine_state() { clear(); }
+        void clear() {
+            for (int r = 0; r < 16; r++) known[r] = false;
+            cells.clear();
+        }
+        bool holds(int reg, int32_t constant) const { return known[reg] && value[reg] == constant; }
+        bool address(int reg, int32_t* at) const {
+            if (known[reg]) *at = value[reg];
+            return known[reg];
+        }
+        // register holding the word at address, or -1
+        int cell(int32_t at) const {
+            for (size_t c = 0; c < cells.size(); c++) {
+                if (cells[c].first == at) return cells[c].second;
+            }
+            return -1;
+        }
+        void overwrite(int reg) {
+            known[reg] = false;
+            for (size_t c = 0; c < cells.size(); c++) {
+                if (cells[c].second == reg) cells[c--] = cells.back(), cells.pop_back();
+            }
+        }
+        void set(int reg, int32_t constant) {
+            overwrite(reg);
+            known[reg] = true;
+            value[reg] = constant;
+        }
+        void copy(int dst, int src) {
+            overwrite(dst);
+            known[dst] = known[src];
+            value[dst] = value[src];
+        }
+        void stored(int32_t at, int reg) {
+            for (size_t c = 0; c < cells.size(); c++) {
+                if (cells[c].first == at) cells[c--] = cells.back(), cells.pop_back();
+            }
+            cells.push_back(std::make_pair(at, reg));
+        }
+        void forget_memory() { cells.clear(); }
+};
+
+int peephole_physical(code_buffer& code) {
+    std::vector<instruction>& insts = code.code;
+    machine_state state;
+    std::vector<std::pair<int32_t, size_t> > unread; // stores nothing has read yet, by address
+    for (size_t i = 0; i < insts.size(); i++) {
+        instruction& inst = insts[i];
+        if (inst.op == IR_LABEL || is_branch(inst)) {
+            unread.clear();
+            // the state carries on past a conditional jump, but nothing is known at a label
+            if (inst.op == IR_LABEL || inst.op == OP_JMPR || inst.op == OP_RET) state.clear();
+            if (inst.op == OP_LOOP) state.overwrite(REG_CNT);
+            continue;
+        }
+        int32_t at;
+        if (inst.op == OP_LIMM) {
+            if (state.holds(inst.a, inst.imm)) inst.op = DELETED;
+            else state.set(inst.a, inst.imm);
+        }
+        else if (inst.op == OP_MOV) {
+            if (inst.a == inst.b) inst.op = DELETED;
+            else state.copy(inst.a, inst.b);
+        }
+        else if (inst.op == OP_MEM && inst.port == PORT_NONE && inst.mode == MEM_STOR) {
+            if (!state.address(inst.a, &at)) {
+                state.forget_memory();
+                unread.clear();
+                continue;
+            }
+            for (size_t u = 0; u < unread.size(); u++) {
+                if (unread[u].first != at) continue;
+                insts[unread[u].second].op = DELETED;
+                unread[u--] = unread.back(), unread.pop_back();
+            }
+            unread.push_back(std::make_pair(at, i));
+            state.stored(at, inst.b);
+        }
+        else if (inst.op == OP_MEM && inst.port == PORT_NONE && inst.mode == MEM_LOAD) {
+            if (!state.address(inst.b, &at)) {
+                state.overwrite(inst.a);
+                state.forget_memory();
+                unread.clear();
+                continue;
+            }
+            int holder = state.cell(at);
+            if (holder == inst.a) {
+                inst.op = DELETED;
+                continue;
+            }
+            if (holder >= 0) {
+                inst = ir_at(ir_mov(inst.a, holder), inst.line);
+                state.copy(inst.a, holder);
+                continue;
+            }
+            for (size_t u = 0; u < unread.size(); u++) {
+                if (unread[u].first == at) unread[u--] = unread.back(), unread.pop_back();
+            }
+            state.overwrite(inst.a);
+            state.stored(at, inst.a);
+        }
+        else if (inst.op == OP_CNT) {
+            state.overwrite(REG_CNT);
+        }
+        else if (int* def = ir_def(inst)) {
+            state.overwrite(*def);
+        }
+    }
+
+    // with spilling, the spill address register is only ever read by the MEM right after its LIMM
+    // or in the same straight-line code, so a LIMM of it nothing reads before a label is dead
+    if (code.spill_slots > 0) {
+        bool live = false;
+        for (size_t i = insts.size(); i-- > 0;) {
+            instruction& inst = insts[i];
+            if (inst.op == IR_LABEL) live = false;
+            else if (inst.op == OP_LIMM && inst.a == SPILL_ADDR) {
+                if (!live) inst.op = DELETED;
+                live = false;
+            }
+            else if (inst.op == OP_MEM && inst.port == PORT_NONE) {
+                if ((inst.mode == MEM_STOR ? inst.a : inst.b) == SPILL_ADDR) live = true;
+            }
+        }
+    }
+    return compact(code);
+}
@@ -0,0 +1,40 @@
+/*
+peephole.h
+Author: Kristopher J. Carroll
+Description:
+    Peephole optimizer cleaning up the instruction buffer around register allocation. Code
+    generation emits every statement on its own, so the seams between statements are full of
+    instructions that a look at a few neighbours shows to be useless.
+
+    Before allocation, working on virtual registers:
+        - a temporary computed only to be copied into another register is computed into that
+          register directly, removing the MOV
+        - a LIMM feeding a single MATH on a register updated in place becomes a MATHI (or INC/DEC)
+        - values that are never read, and variable writes overwritten before being read within the
+          same straight-line code, are dropped
+        - jumps to a JMP go straight to its target (forward jumps only, so loops keep the shape the
+          allocator expects), jumps to the next instruction and code after an unconditional JMP
+          are removed, along with comparisons no conditional jump reads
+
+    After allocation, working on physical registers and spill code:
+        - MOVs of a register onto itself are dropped
+        - LIMMs reloading a value the register already holds are dropped, which mostly removes
+          reloads of spill addresses
+        - loads of a memory word whose value is still in a register become a MOV or disappear
+        - stores overwritten by another store to the same word before anything reads it are dropped
+
+    Labels are still in place for both passes, so they can tell where straight-line code ends.
+*/
+
+#ifndef PEEPHOLE_H
+#define PEEPHOLE_H
+
+#include "IR.h"
+
+// optimizes code on virtual registers, returning how many instructions were removed
+int peephole_virtual(code_buffer& code);
+
+// optimizes allocated code and its spill code, returning how many instructions were removed
+int peephole_physical(code_buffer& code);
+
+#endif
@@ -0,0 +1,291 @@
+/*
+redundancy.cpp
+Author: Kristopher J. Carroll
+Description:
+    Value numbering and loop-invariant code motion, see redundancy.h.
+*/
+
+#include <stdint.h>
+#include <algorithm>
+#include <unordered_map>
+#include <vector>
+#include "redundancy.h"
+
+static bool ends_block(const instruction& i) {
+    return ir_is_jump(i) || i.op == OP_RET;
+}
+
+// an operation on numbered values, the same key meaning the same value
+struct value_key {
+    int op, mode, x, y;
+    int32_t imm;
+    bool operator==(const value_key& other) const {
+        return op == other.op && mode == other.mode && x == other.x && y == other.y && imm == other.imm;
+    }
+};
+
+struct value_key_hash {
+    size_t operator()(const value_key& k) const {
+        uint64_t h = (uint64_t)k.op * 31 + k.mode;
+        h = h * 0x9e3779b97f4a7c15ull + (uint32_t)k.x;
+        h = h * 0x9e3779b97f4a7c15ull + (uint32_t)k.y;
+        h = h * 0x9e3779b97f4a7c15ull + (uint32_t)k.imm;
+        return h ^ (h >> 29);
+    }
+};
+
+// value numbers of the registers within one basic block at a time
+class value_table {
+    protected:
+        std::vector<int> number; // per register, its value in the current block
+        std::vector<int> stamp; // block the number belongs to, older numbers are stale
+        std::vector<int> first, latest; // per value, virtual registers given it, -1 if none
+        std::vector<uint8_t> constant; // per value, whether a LIMM produced it
+        std::unordered_map<value_key, int, value_key_hash> computed;
+        std::vector<value_key> keys; // entries made in the current block
+        int block;
+    public:
+        value_table(size_t registers) : number(registers), stamp(registers, -1), block(0) { }
+
+        // forgets everything known about the registers, for the start of a block
+        void next_block() {
+            block++;
+            for (size_t k = 0; k < keys.size(); k++) computed.erase(keys[k]);
+            keys.clear();
+        }
+        int fresh(bool is_constant = false) {
+            first.push_back(-1);
+            latest.push_back(-1);
+            constant.push_back(is_constant);
+            return first.size() - 1;
+        }
+        // the value in reg, a new one if nothing is known about it in this block
+        int value(int reg) {
+            if (stamp[reg] != block) {
+                stamp[reg] = block;
+                number[reg] = fresh();
+                if (ir_is_vreg(reg)) first[number[reg]] = latest[number[reg]] = reg;
+            }
+            return number[reg];
+        }
+        bool holds(int reg, int v) const { return reg >= 0 && stamp[reg] == block && number[reg] == v; }
+        bool is_constant(int v) const { return constant[v]; }
+        // a virtual register holding v, preferring the one that computed it, -1 if none does
+        int holder(int v) const {
+            if (holds(first[v], v)) return first[v];
+            if (holds(latest[v], v)) return latest[v];
+            return -1;
+        }
+        void write(int reg, int v) {
+            stamp[reg] = block;
+            number[reg] = v;
+            if (!ir_is_vreg(reg)) return;
+            if (!holds(first[v], v)) first[v] = reg;
+            latest[v] = reg;
+        }
+        // the value k produces, found is set when something computed it before
+        int lookup(const value_key& k, bool is_constant, bool& found) {
+            std::unordered_map<value_key, int, value_key_hash>::iterator at = computed.find(k);
+            found = at != computed.end();
+            if (found) return at->second;
+            int v = fresh(is_constant);
+            computed[k] = v;
+            keys.push_back(k);
+            return v;
+        }
+};
+
+int eliminate_common_subexpressions(code_buffer& code) {
+    std::vector<instruction>& insts = code.code;
+    value_table values(IR_VREG_BASE + code.vregs());
+    int replaced = 0;
+    for (size_t i = 0; i < insts.size(); i++) {
+        instruction& inst = insts[i];
+        if (inst.op == IR_LABEL || (i > 0 && ends_block(insts[i - 1]))) values.next_block();
+        if (inst.op == IR_LABEL) continue;
+
+        // reads of a copy go to the register that computed the value, except for updates in place
+        bool in_place = inst.op == OP_MATHI || inst.op == OP_INC || inst.op == OP_DEC;
+        int* uses[2];
+        int count = ir_uses(inst, uses);
+        for (int u = 0; u < count && !in_place; u++) {
+            int v = values.value(*uses[u]);
+            int h = values.holder(v);
+            if (h >= 0 && !values.is_constant(v)) *uses[u] = h;
+        }
+
+        int* def = ir_def(inst);
+        if (!def) continue;
+        value_key k = { inst.op, inst.mode, 0, 0, 0 };
+        switch (inst.op) {
+            case OP_MOV:
+                values.write(inst.a, values.value(inst.b));
+                continue;
+            case OP_LIMM:
+                k.imm = inst.imm;
+                break;
+            case OP_MATH:
+                k.x = values.value(inst.b);
+                k.y = values.value(inst.c);
+                if ((inst.mode == MATH_ADD || inst.mode == MATH_MULT) && k.x > k.y) std::swap(k.x, k.y);
+                break;
+            case OP_MATHI:
+            case OP_INC:
+            case OP_DEC:
+                // every way of adding a constant is numbered as the one MATHI ADD
+                k.op = OP_MATHI;
+                k.x = values.value(inst.a);
+                k.imm = inst.op == OP_INC ? 1 : inst.op == OP_DEC ? -1 : inst.imm;
+                if (inst.op != OP_MATHI) k.mode = MATH_ADD;
+                else if (inst.mode == MATH_SUB) k.mode = MATH_ADD, k.imm = 0u - (uint32_t)inst.imm;
+                break;
+            default:
+                // loads and input give values nothing else can
+                values.write(*def, values.fresh());
+                continue;
+        }
+        bool found;
+        int v = values.lookup(k, inst.op == OP_LIMM, found);
+        int h = found ? values.holder(v) : -1;
+        // constants are loaded again, anything else still held somewhere is copied
+        if (h >= 0 && inst.op != OP_LIMM) {
+            inst = ir_at(ir_mov(*def, h), inst.line);
+            replaced++;
+        }
+        values.write(inst.a, v);
+    }
+    return replaced;
+}
+
+// whether moving i to run before its loop, and even when the code around it in the loop would
+// not have run it, changes nothing but how often it runs
+static bool movable(const instruction& i) {
+    switch (i.op) {
+        case OP_MOV:
+        case OP_LIMM:
+        case OP_INC:
+        case OP_DEC: return true;
+        case OP_MATH: return i.mode != MATH_DIV;
+        case OP_MATHI: return i.mode != MATH_DIV || i.imm != 0;
+        default: return false;
+    }
+}
+
+int hoist_loop_invariants(code_buffer& code) {
+    std::vector<instruction>& insts = code.code;
+    int n = insts.size();
+    std::vector<int> label_pos(code.labels(), -1);
+    for (int i = 0; i < n; i++) {
+        if (insts[i].op == IR_LABEL) label_pos[insts[i].imm] = i;
+    }
+    int vregs = code.vregs();
+    std::vector<int> writes(vregs, 0); // in the whole program
+    for (int i = 0; i < n; i++) {
+        int* def = ir_def(insts[i]);
+        if (def && ir_is_vreg(*def)) writes[*def - IR_VREG_BASE]++;
+    }
+
+    // what is known about each register inside the loop being looked at, valid while stamp matches
+    enum { UNKNOWN, INVARIANT, VARIANT };
+    std::vector<int> stamp(vregs, -1), loop_writes(vregs), first_write(vregs), last_write(vregs);
+    std::vector<uint8_t> read_first(vregs), state(vregs);
+    std::vector<int> block(n, 0); // straight-line run each instruction of the loop belongs to
+    std::vector<uint8_t> hoist(n, 0);
+    std::vector<int> candidates; // instructions writing temporaries that may be invariant, in order
+    std::vector<instruction> moved_code;
+    int moved = 0;
+
+    // inner loops come after the loops containing them, so going backwards does them first
+    for (size_t l = code.loops.size(); l-- > 0;) {
+        int head = label_pos[code.loops[l].head];
+        int exit = label_pos[code.loops[l].exit];
+        if (head < 0 || exit <= head) continue;
+
+        for (int i = head + 1, run = 0; i < exit; i++) {
+            if (insts[i].op == IR_LABEL || ends_block(insts[i - 1])) run++;
+            block[i] = run;
+            int* operands[3];
+            int count = ir_uses(insts[i], operands);
+            int* def = ir_def(insts[i]);
+            // an update in place reads what it writes, counted as the write
+            if (def && (count == 0 || operands[0] != def)) operands[count++] = def;
+            for (int o = 0; o < count; o++) {
+                if (!ir_is_vreg(*operands[o])) continue;
+                int v = *operands[o] - IR_VREG_BASE;
+                if (stamp[v] != (int)l) {
+                    stamp[v] = l;
+                    loop_writes[v] = 0;
+                    read_first[v] = 0;
+                    state[v] = UNKNOWN;
+                }
+                if (operands[o] != def) {
+                    if (loop_writes[v] == 0) read_first[v] = 1;
+                    continue;
+                }
+                if (loop_writes[v]++ == 0) first_write[v] = i;
+                last_write[v] = i;
+            }
+        }
+
+        // temporaries written only here, all in one straight-line run, with every write movable
+        // and nothing else in the loop reading them until the last write is done
+        candidates.clear();
+        for (int i = head + 1; i < exit; i++) {
+            int* uses[2];
+            int count = ir_uses(insts[i], uses);
+            int* def = ir_def(insts[i]);
+            for (int u = 0; u < count; u++) {
+                int v = *uses[u] - IR_VREG_BASE;
+                if (v >= 0 && uses[u] != def && i < last_write[v] && loop_writes[v]) state[v] = VARIANT;
+            }
+            if (!def || !ir_is_vreg(*def)) continue;
+            int v = *def - IR_VREG_BASE;
+            bool ok = !code.variables[v] && loop_writes[v] == writes[v] && !read_first[v] &&
+                      block[first_write[v]] == block[last_write[v]] && movable(insts[i]);
+            if (state[v] == VARIANT) continue;
+            if (!ok) {
+                state[v] = VARIANT;
+                continue;
+            }
+            state[v] = INVARIANT;
+            candidates.push_back(i);
+        }
+
+        // a temporary is invariant when everything its writes read is, dropping those that are not
+        // until none are left to drop
+        for (bool changed = true; changed;) {
+            changed = false;
+            for (size_t c = 0; c < candidates.size(); c++) {
+                instruction& inst = insts[candidates[c]];
+                int v = inst.a - IR_VREG_BASE;
+                if (state[v] != INVARIANT) continue;
+                int* uses[2];
+                int count = ir_uses(inst, uses);
+                for (int u = 0; u < count; u++) {
+                    if (*uses[u] == inst.a) continue;
+                    int w = *uses[u] - IR_VREG_BASE;
+                    bool unchanged = w >= 0 && (stamp[w] != (int)l || loop_writes[w] == 0 || state[w] == INVARIANT);
+                    if (!unchanged) {
+                        state[v] = VARIANT;
+                        changed = true;
+                        break;
+                    }
+                }
+            }
+        }
+
+        // the invariant writes go in front of the label at the head, keeping their order
+        int count = 0;
+        for (size_t c = 0; c < candidates.size(); c++) {
+            if (state[insts[candidates[c]].a - IR_VREG_BASE] == INVARIANT) hoist[candidates[c]] = 1, count++;
+        }
+        if (!count) continue;
+        moved_code.clear();
+        for (int i = head; i < exit; i++) if (hoist[i]) moved_code.push_back(insts[i]);
+        for (int i = head; i < exit; i++) if (!hoist[i]) moved_code.push_back(insts[i]);
+        for (int i = head; i < exit; i++) hoist[i] = 0;
+        std::copy(moved_code.begin(), moved_code.end(), insts.begin() + head);
+        moved += count;
+    }
+    return moved;
+}
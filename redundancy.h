@@ -0,0 +1,37 @@
+/*
+redundancy.h
+Author: Kristopher J. Carroll
+Description:
+    Passes removing computation that is repeated for nothing, run on virtual registers right after
+    code generation, before the peephole optimizer cleans up what they leave behind.
+
+    Common subexpressions are found by value numbering each basic block: every value gets a number
+    when it is computed, operations on the same numbers again (a + b and b + a alike) give the
+    number they gave before, and a value still held by a register is copied from it instead of
+    being computed again. Reads of a register holding a copy of a value are pointed at the
+    register that computed it, so the copies themselves usually end up dead. Constants are
+    numbered like everything else but always loaded again, since a LIMM is as cheap as the MOV
+    and the peephole optimizer folds them into MATHI.
+
+    Loop-invariant code motion moves the temporaries of a loop body whose operands do not change
+    inside the loop into the loop's preheader, ahead of the label at its head, so they are computed
+    once for every time the loop is entered instead of once per iteration. The preheader comes after
+    the test skipping a loop that never runs, so nothing is computed for a loop that is not entered.
+    Inner loops are done first, so code invariant in a whole nest moves out one loop at a time.
+    Only temporaries are moved, all of their writes together, and only when nothing in the loop
+    reads them before the last of those writes. Division by a register is never moved, since
+    inside an IF it may be guarding against the division by zero it would then fault on.
+*/
+
+#ifndef REDUNDANCY_H
+#define REDUNDANCY_H
+
+#include "IR.h"
+
+// replaces computations of values still held in a register with copies, returning how many
+int eliminate_common_subexpressions(code_buffer& code);
+
+// moves loop-invariant temporaries out of loops, returning how many instructions were moved
+int hoist_loop_invariants(code_buffer& code);
+
+#endif
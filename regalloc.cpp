@@ -0,0 +1,191 @@
+/*
+regalloc.cpp
+Author: Kristopher J. Carroll
+Description:
+    Linear-scan register allocation with spilling, see regalloc.h.
+*/
+
+#include <limits.h>
+#include <algorithm>
+#include "liveness.h"
+#include "regalloc.h"
+
+struct live_interval {
+    int start, end; // first and last instruction index covered
+    double weight; // spill cost, references weighted by loop depth
+    int reg; // assigned physical register, or -1 when spilled
+};
+
+// computes the live interval of every virtual register in code
+static void build_intervals(code_buffer& code, std::vector<live_interval>& intervals) {
+    std::vector<instruction>& insts = code.code;
+    int n = insts.size();
+
+    // loop nesting depth of every instruction, found from the labels bounding each loop
+    std::vector<int> label_pos(code.labels(), -1);
+    for (int i = 0; i < n; i++) {
+        if (insts[i].op == IR_LABEL) label_pos[insts[i].imm] = i;
+    }
+    std::vector<int> depth(n + 1, 0);
+    for (size_t l = 0; l < code.loops.size(); l++) {
+        depth[label_pos[code.loops[l].head]]++;
+        depth[label_pos[code.loops[l].exit]]--;
+    }
+    for (int i = 1; i <= n; i++) depth[i] += depth[i - 1];
+
+    // the spans come from liveness analysis, the weights from counting references
+    std::vector<live_range> ranges;
+    live_ranges(code, ranges);
+    intervals.assign(code.vregs(), live_interval());
+    for (size_t v = 0; v < intervals.size(); v++) {
+        intervals[v].start = ranges[v].start;
+        intervals[v].end = ranges[v].end;
+        intervals[v].weight = 0;
+        intervals[v].reg = -1;
+    }
+
+    for (int i = 0; i < n; i++) {
+        double weight = 1;
+        for (int d = 0; d < depth[i] && d < 6; d++) weight *= 10;
+
+        int* operands[3];
+        int count = ir_uses(insts[i], operands);
+        if (int* def = ir_def(insts[i])) operands[count++] = def;
+        for (int o = 0; o < count; o++) {
+            if (ir_is_vreg(*operands[o])) intervals[*operands[o] - IR_VREG_BASE].weight += weight;
+        }
+    }
+}
+
+// assigns registers from the given pool, returning whether any interval had to be spilled
+static bool linear_scan(std::vector<live_interval>& intervals, int pool_size) {
+    std::vector<int> order;
+    for (size_t v = 0; v < intervals.size(); v++) {
+        intervals[v].reg = -1;
+        if (intervals[v].end >= 0) order.push_back(v);
+    }
+    std::stable_sort(order.begin(), order.end(), [&intervals](int a, int b) {
+        return intervals[a].start < intervals[b].start;
+    });
+
+    std::vector<int> free_regs;
+    for (int r = REG_R0 + pool_size - 1; r >= REG_R0; r--) free_regs.push_back(r);
+    std::vector<int> active; // sorted by interval end
+    bool spilled = false;
+
+    for (size_t o = 0; o < order.size(); o++) {
+        int v = order[o];
+        live_interval& cur = intervals[v];
+
+        // expiring intervals that ended before this one starts
+        size_t expired = 0;
+        while (expired < active.size() && intervals[active[expired]].end < cur.start) {
+            free_regs.push_back(intervals[active[expired]].reg);
+            expired++;
+        }
+        active.erase(active.begin(), active.begin() + expired);
+        // handing out the lowest numbered free register first
+        std::sort(free_regs.begin(), free_regs.end(), std::greater<int>());
+
+        if (!free_regs.empty()) {
+            cur.reg = free_regs.back();
+            free_regs.pop_back();
+        }
+        else {
+            // spilling whichever of the active intervals and this one is cheapest to keep in memory
+            size_t victim = 0;
+            for (size_t a = 1; a < active.size(); a++) {
+                if (intervals[active[a]].weight < intervals[active[victim]].weight) victim = a;
+            }
+            spilled = true;
+            if (intervals[active[victim]].weight < cur.weight) {
+                cur.reg = intervals[active[victim]].reg;
+                intervals[active[victim]].reg = -1;
+                active.erase(active.begin() + victim);
+            }
+            else {
+                continue;
+            }
+        }
+        std::vector<int>::iterator pos = std::upper_bound(active.begin(), active.end(), v, [&intervals](int a, int b) {
+            return intervals[a].end < intervals[b].end;
+        });
+        active.insert(pos, v);
+    }
+    return spilled;
+}
+
+void allocate_registers(code_buffer& code) {
+    std::vector<live_interval> intervals;
+    build_intervals(code, intervals);
+
+    // all 14 registers are available unless something spills, then three are kept for spill code
+    if (linear_scan(intervals, 14)) linear_scan(intervals, 11);
+
+    // spilled variables live at the data address of their symbol table slot, spilled temporaries
+    // are placed after all of the variables
+    std::vector<int> slot(intervals.size(), -1);
+    int temporaries = 0;
+    for (size_t v = 0; v < intervals.size(); v++) {
+        if (intervals[v].end < 0 || intervals[v].reg >= 0) continue;
+        slot[v] = (int)v < code.variable_count ? v : code.variable_count + temporaries++;
+        code.spill_slots = std::max(code.spill_slots, slot[v] + 1);
+    }
+
+    std::vector<instruction> out;
+    out.reserve(code.code.size());
+    for (size_t i = 0; i < code.code.size(); i++) {
+        instruction inst = code.code[i];
+        if (inst.op == IR_LABEL) {
+            out.push_back(inst);
+            continue;
+        }
+        int* uses[2];
+        int count = ir_uses(inst, uses);
+        int* def = ir_def(inst);
+        int def_vreg = def ? *def : -1;
+
+        // loading spilled operands into scratch registers
+        int loaded_vreg[2] = { -1, -1 };
+        int loaded = 0;
+        for (int u = 0; u < count; u++) {
+            if (!ir_is_vreg(*uses[u])) continue;
+            int v = *uses[u] - IR_VREG_BASE;
+            if (slot[v] < 0) {
+                *uses[u] = intervals[v].reg;
+                continue;
+            }
+            int scratch = -1;
+            for (int l = 0; l < loaded; l++) {
+                if (loaded_vreg[l] == v) scratch = l == 0 ? SPILL_VALUE_1 : SPILL_VALUE_2;
+            }
+            if (scratch < 0) {
+                scratch = loaded == 0 ? SPILL_VALUE_1 : SPILL_VALUE_2;
+                loaded_vreg[loaded++] = v;
+                out.push_back(ir_at(ir_limm(SPILL_ADDR, slot[v]), inst.line));
+                out.push_back(ir_at(ir_mem(scratch, SPILL_ADDR, MEM_LOAD, PORT_NONE), inst.line));
+            }
+            *uses[u] = scratch;
+        }
+
+        // writing a spilled result back to its slot after the instruction
+        int store_slot = -1, store_reg = -1;
+        if (def && ir_is_vreg(def_vreg)) {
+            int v = def_vreg - IR_VREG_BASE;
+            if (slot[v] < 0) {
+                *def = intervals[v].reg;
+            }
+            else {
+                store_reg = loaded > 1 && loaded_vreg[1] == v ? SPILL_VALUE_2 : SPILL_VALUE_1;
+                store_slot = slot[v];
+                *def = store_reg;
+            }
+        }
+        out.push_back(inst);
+        if (store_slot >= 0) {
+            out.push_back(ir_at(ir_limm(SPILL_ADDR, store_slot), inst.line));
+            out.push_back(ir_at(ir_mem(SPILL_ADDR, store_reg, MEM_STOR, PORT_NONE), inst.line));
+        }
+    }
+    code.code.swap(out);
+}
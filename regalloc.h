@@ -0,0 +1,39 @@
+/*
+regalloc.h
+Author: Kristopher J. Carroll
+Description:
+    Linear-scan register allocator mapping the virtual registers produced by code generation onto
+    the 14 general purpose SAD VM registers (R_0 through R_13).
+
+    Every virtual register gets a live interval spanning the instructions over which liveness
+    analysis (liveness.h) finds it holding a value still needed, so values carried around a loop
+    survive the back edge, and a variable read before it is first written is live from the start of
+    the program (reading the zero the VM starts with), while a variable only used within one pass
+    through a loop body does not hold its register for the rest of the loop.
+    Each interval is weighted by its references, scaled by ten for every level of loop nesting.
+    When no register is free the lightest interval is spilled, keeping hot loop variables in
+    registers and pushing cold ones out to data memory.
+
+    A spilled virtual register lives in its own data memory word and is
+    accessed with MEM LOAD/STOR around each instruction referencing it. Spill code needs R_11 and R_12
+    as scratch values and R_13 for the spill address, so those three registers are only handed out
+    when the program fits without spilling.
+
+    Spilled program variables use the data address equal to their symbol table slot, so variable k is
+    always found at address k, and spilled temporaries follow the last variable.
+*/
+
+#ifndef REGALLOC_H
+#define REGALLOC_H
+
+#include "IR.h"
+
+// scratch registers reserved for spill code
+const int SPILL_VALUE_1 = REG_R11;
+const int SPILL_VALUE_2 = REG_R12;
+const int SPILL_ADDR = REG_R13;
+
+// rewrites every virtual register in code to a physical register, inserting spill code as needed
+void allocate_registers(code_buffer& code);
+
+#endif
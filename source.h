@@ -0,0 +1,97 @@
+/*
+source.h
+Author: Kristopher J. Carroll
+Description:
+    Program source held in memory for the whole parse, so the scanner can work on it in place. A
+    regular file is mapped straight into memory, anything else (a pipe, a terminal) is read into one
+    buffer up front. Either way the text is followed by the two NUL bytes flex expects at the end of a
+    buffer handed to yy_scan_buffer, and since flex writes into the buffer while scanning the mapping
+    is private, so the file itself is never touched.
+
+    Because the text stays put until parsing is finished, tokens refer to it directly with spans
+    instead of copies, and identifiers are only copied when interned into the symbol table.
+*/
+
+#ifndef SOURCE_H
+#define SOURCE_H
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// a piece of the source text, usable as a token value since it has no constructor
+struct source_span {
+    const char* text;
+    size_t length;
+};
+
+class source_buffer {
+    protected:
+        char* text;
+        size_t length; // source length, not counting the two trailing NULs
+        bool mapped; // text is a mapping rather than a malloc'd buffer
+
+        bool map(FILE* in) {
+            struct stat info;
+            int fd = fileno(in);
+            if (fd < 0 || fstat(fd, &info) != 0 || !S_ISREG(info.st_mode)) return false;
+            length = info.st_size;
+            // zeroed anonymous pages for the whole buffer with the file mapped over the front of them,
+            // so the bytes after the text are NUL even when the file ends on a page boundary
+            void* base = mmap(NULL, length + 2, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (base == MAP_FAILED) return false;
+            if (length && mmap(base, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+                munmap(base, length + 2);
+                return false;
+            }
+            text = (char*)base;
+            mapped = true;
+            return true;
+        }
+        bool read(FILE* in) {
+            size_t capacity = 64 * 1024;
+            text = (char*)malloc(capacity);
+            length = 0;
+            while (text) {
+                length += fread(text + length, 1, capacity - length - 2, in);
+                if (length + 2 < capacity) break;
+                capacity *= 2;
+                char* grown = (char*)realloc(text, capacity);
+                if (!grown) free(text);
+                text = grown;
+            }
+            if (!text) return false;
+            text[length] = text[length + 1] = '\0';
+            return !ferror(in);
+        }
+    public:
+        source_buffer() : text(NULL), length(0), mapped(false) { }
+        ~source_buffer() {
+            if (mapped) munmap(text, length + 2);
+            else free(text);
+        }
+
+        // takes in the whole source from in, returning false if it could not be read
+        bool load(FILE* in) { return map(in) || read(in); }
+        // takes a copy of source already in memory, returning false if there was no memory for it
+        bool load(const char* source, size_t size) {
+            text = (char*)malloc(size + 2);
+            if (!text) return false;
+            memcpy(text, source, size);
+            length = size;
+            text[length] = text[length + 1] = '\0';
+            return true;
+        }
+
+        // the source text itself
+        const char* get_text() const { return text; }
+        size_t size() const { return length; }
+        // start of the text and the size of the buffer to scan, including the trailing NULs
+        char* scan_base() { return text; }
+        size_t scan_size() const { return length + 2; }
+};
+
+#endif
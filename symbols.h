@@ -0,0 +1,110 @@
+/*
+symbols.h
+Author: Kristopher J. Carroll
+Description:
+    Interned, hash based symbol table for program variables. Each distinct name is copied into the
+    arena once, when it is first interned or declared, and every later use shares that copy. Names
+    are passed with a length, so identifier tokens pointing into the source text are looked up in
+    place without copying them first. Declaring a variable gives it a dense slot number in
+    declaration order, which is how the rest of the compiler refers to it: the evaluator's slot
+    array, the program variables' virtual registers and their spill addresses in VM data memory are
+    all indexed by slot.
+
+    Names are kept in an open addressing table (linear probing, power of two capacity, at most half
+    full) holding indices into a vector of entries, so a lookup is one hash and usually one compare.
+*/
+
+#ifndef SYMBOLS_H
+#define SYMBOLS_H
+
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+#include "arena.h"
+#include "AST.h"
+
+class symbol_table {
+    protected:
+        struct entry {
+            const char* name; // interned copy in the arena
+            size_t length;
+            uint32_t hash;
+            var_node* var; // variable declared with this name, or NULL
+        };
+        arena& pool;
+        std::vector<entry> entries;
+        std::vector<int32_t> table; // entry index per bucket, -1 when empty
+        std::vector<var_node*> variables; // declared variables by slot
+
+        static uint32_t hash_name(const char* name, size_t length) {
+            // FNV-1a
+            uint32_t hash = 2166136261u;
+            for (size_t i = 0; i < length; i++) hash = (hash ^ (uint8_t)name[i]) * 16777619u;
+            return hash;
+        }
+        // bucket holding name, or the empty bucket where it belongs
+        size_t find(const char* name, size_t length, uint32_t hash) const {
+            size_t mask = table.size() - 1;
+            size_t bucket = hash & mask;
+            while (table[bucket] >= 0) {
+                const entry& e = entries[table[bucket]];
+                if (e.hash == hash && e.length == length && memcmp(e.name, name, length) == 0) break;
+                bucket = (bucket + 1) & mask;
+            }
+            return bucket;
+        }
+        void grow() {
+            table.assign(table.size() * 2, -1);
+            for (size_t i = 0; i < entries.size(); i++) {
+                table[find(entries[i].name, entries[i].length, entries[i].hash)] = i;
+            }
+        }
+        entry* lookup_entry(const char* name, size_t length) {
+            int32_t index = table[find(name, length, hash_name(name, length))];
+            return index < 0 ? NULL : &entries[index];
+        }
+    public:
+        symbol_table(arena& pool_) : pool(pool_), table(64, -1) { }
+
+        // returns the shared copy of name, copying it into the arena the first time it is seen
+        const char* intern(const char* name, size_t length) {
+            uint32_t hash = hash_name(name, length);
+            size_t bucket = find(name, length, hash);
+            if (table[bucket] >= 0) return entries[table[bucket]].name;
+            entry e;
+            e.name = pool.copy_string(name, length);
+            e.length = length;
+            e.hash = hash;
+            e.var = NULL;
+            table[bucket] = entries.size();
+            entries.push_back(e);
+            if (entries.size() * 2 > table.size()) grow();
+            return e.name;
+        }
+        // declares a variable with the next slot, returning NULL if name is already declared
+        var_node* declare(const char* name, size_t length) {
+            intern(name, length);
+            entry* e = lookup_entry(name, length);
+            if (e->var) return NULL;
+            e->var = new (pool) var_node(e->name, variables.size());
+            variables.push_back(e->var);
+            return e->var;
+        }
+        var_node* declare(const char* name) { return declare(name, strlen(name)); }
+        // the variable declared as name, or NULL
+        var_node* lookup(const char* name, size_t length) {
+            entry* e = lookup_entry(name, length);
+            return e ? e->var : NULL;
+        }
+        var_node* lookup(const char* name) { return lookup(name, strlen(name)); }
+
+        int size() const { return variables.size(); }
+        var_node* variable(int slot) const { return variables[slot]; }
+        void clear() {
+            entries.clear();
+            variables.clear();
+            table.assign(64, -1);
+        }
+};
+
+#endif
@@ -0,0 +1,75 @@
+/*
+thread_pool.h
+Author: Kristopher J. Carroll
+Description:
+    Work-stealing pool for running a batch of independent jobs across all cores, used by the batch
+    compile driver. The jobs are numbered 0 to count - 1 and dealt out up front in contiguous runs,
+    one run per worker. Each worker takes jobs from the back of its own queue, and once that is
+    empty steals from the front of the other workers' queues, so a worker stuck with large files
+    does not hold up the batch while the others sit idle.
+
+    Each queue has its own lock, which is only contended while stealing.
+*/
+
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <stddef.h>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class work_stealing_pool {
+    protected:
+        struct worker_queue {
+            std::mutex lock;
+            std::deque<size_t> jobs;
+        };
+        std::vector<worker_queue> queues;
+
+        bool pop_own(size_t worker, size_t* job) {
+            std::lock_guard<std::mutex> guard(queues[worker].lock);
+            if (queues[worker].jobs.empty()) return false;
+            *job = queues[worker].jobs.back();
+            queues[worker].jobs.pop_back();
+            return true;
+        }
+        bool steal(size_t thief, size_t* job) {
+            for (size_t i = 1; i < queues.size(); i++) {
+                worker_queue& victim = queues[(thief + i) % queues.size()];
+                std::lock_guard<std::mutex> guard(victim.lock);
+                if (victim.jobs.empty()) continue;
+                *job = victim.jobs.front();
+                victim.jobs.pop_front();
+                return true;
+            }
+            return false;
+        }
+        void work(size_t worker, const std::function<void(size_t)>& job) {
+            size_t next;
+            // no job ever adds more work, so once every queue is empty the batch is done
+            while (pop_own(worker, &next) || steal(worker, &next)) job(next);
+        }
+    public:
+        work_stealing_pool(size_t threads) : queues(threads ? threads : 1) { }
+
+        // runs job(0) to job(count - 1), returning once all of them have finished
+        void run(size_t count, const std::function<void(size_t)>& job) {
+            size_t workers = queues.size();
+            for (size_t w = 0; w < workers; w++) {
+                // jobs are popped from the back, so they are queued in reverse to start in order
+                size_t first = count * w / workers, last = count * (w + 1) / workers;
+                for (size_t j = last; j > first; j--) queues[w].jobs.push_back(j - 1);
+            }
+            std::vector<std::thread> threads;
+            for (size_t w = 1; w < workers; w++) {
+                threads.push_back(std::thread(&work_stealing_pool::work, this, w, std::cref(job)));
+            }
+            work(0, job);
+            for (size_t t = 0; t < threads.size(); t++) threads[t].join();
+        }
+};
+
+#endif